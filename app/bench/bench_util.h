@@ -0,0 +1,106 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+// Helpers shared by the benchmarks: per-call latency percentiles and a
+// fixed-duration multi-threaded throughput run.
+
+using BenchClock = std::chrono::steady_clock;
+
+struct Latency {
+    double p50_ns;
+    double p99_ns;
+    double p999_ns;
+};
+
+inline Latency percentiles(std::vector<double> samples) {
+    if (samples.empty()) {
+        return Latency{0, 0, 0};
+    }
+    std::sort(samples.begin(), samples.end());
+    auto at = [&](double q) { return samples[std::min(samples.size() - 1, static_cast<size_t>(q * samples.size()))]; };
+    return Latency{at(0.5), at(0.99), at(0.999)};
+}
+
+// Times `samples` calls of op(rng) one by one. Includes about 20 ns of clock overhead per call.
+template <typename Op>
+Latency measureLatency(size_t samples, std::mt19937& rng, Op&& op) {
+    std::vector<double> ns;
+    ns.reserve(samples);
+    for (size_t i = 0; i < samples; ++i) {
+        auto start = BenchClock::now();
+        op(rng);
+        ns.push_back(std::chrono::duration<double, std::nano>(BenchClock::now() - start).count());
+    }
+    return percentiles(std::move(ns));
+}
+
+// Runs op(thread_index, rng) on `threads` threads for `duration` and
+// returns the total operations per second.
+template <typename Op>
+double measureThroughput(int threads, std::chrono::milliseconds duration, Op&& op) {
+    std::atomic<bool> go{false};
+    std::atomic<bool> stop{false};
+    std::vector<uint64_t> counts(threads * 8, 0);
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            std::mt19937 rng(1234 + t);
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            uint64_t count = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                for (int i = 0; i < 64; ++i) {
+                    op(t, rng);
+                }
+                count += 64;
+            }
+            // Spaced out so the counters do not share a cache line
+            counts[t * 8] = count;
+        });
+    }
+    auto start = BenchClock::now();
+    go.store(true, std::memory_order_release);
+    std::this_thread::sleep_for(duration);
+    stop.store(true, std::memory_order_relaxed);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+    uint64_t total = 0;
+    for (int t = 0; t < threads; ++t) {
+        total += counts[t * 8];
+    }
+    return total / seconds;
+}
+
+// --name=value from the command line, or `fallback`.
+inline long argValue(int argc, char** argv, const char* name, long fallback) {
+    size_t length = std::strlen(name);
+    for (int i = 1; i < argc; ++i) {
+        if (std::strncmp(argv[i], "--", 2) == 0 && std::strncmp(argv[i] + 2, name, length) == 0 &&
+            argv[i][2 + length] == '=') {
+            return std::atol(argv[i] + 3 + length);
+        }
+    }
+    return fallback;
+}
+
+inline std::vector<int> threadCounts(int argc, char** argv) {
+    int max_threads = static_cast<int>(argValue(argc, argv, "max-threads", 16));
+    std::vector<int> counts;
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    return counts;
+}
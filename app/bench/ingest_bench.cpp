@@ -0,0 +1,77 @@
+// Location ingest benchmark: points per second recorded from 1..N threads,
+// each owning its own vehicles as a sendLocation stream does. The sharded
+// VehicleTable with per-vehicle state is compared with the original
+// design, where every point took one service-wide mutex to append to a
+// shared map of vectors.
+//
+// Usage: ingest_bench [--vehicles=10000] [--max-threads=16] [--duration-ms=1000]
+
+#include <mutex>
+#include <unordered_map>
+
+#include "bench_util.h"
+#include "vehicle_table.h"
+
+namespace {
+
+class GlobalLockLocations {
+public:
+    void record(int32_t vehicle_id, const LocationPoint& point) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto& points = locations_[vehicle_id];
+        // Bounded like the history ring, so both sides do the same work per point
+        if (points.size() == 1024) {
+            points.erase(points.begin(), points.begin() + 512);
+        }
+        points.push_back(point);
+        latest_[vehicle_id] = point;
+    }
+
+private:
+    std::mutex mutex_;
+    std::unordered_map<int32_t, std::vector<LocationPoint>> locations_;
+    std::unordered_map<int32_t, LocationPoint> latest_;
+};
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    const int32_t vehicles = static_cast<int32_t>(argValue(argc, argv, "vehicles", 10000));
+    std::chrono::milliseconds duration(argValue(argc, argv, "duration-ms", 1000));
+    std::printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+    std::printf("== ingest: points/s, %d vehicles ==\n", vehicles);
+    std::printf("%8s %16s %16s %10s\n", "threads", "global mutex", "vehicle table", "scaling");
+
+    double single_thread = 0;
+    for (int threads : threadCounts(argc, argv)) {
+        GlobalLockLocations global;
+        VehicleTable table{LocationHistory::Options{}};
+        // Per-thread cursors over the vehicles each thread owns
+        std::vector<int64_t> cursor(threads * 8, 0);
+
+        auto next_vehicle = [&](int t) {
+            int64_t& c = cursor[t * 8];
+            int32_t vehicle_id = static_cast<int32_t>(t + (c++ % ((vehicles + threads - 1) / threads)) * threads);
+            return vehicle_id % vehicles;
+        };
+        double before = measureThroughput(threads, duration, [&](int t, std::mt19937&) {
+            int64_t c = cursor[t * 8];
+            global.record(next_vehicle(t), LocationPoint{c, 51.0, 19.0});
+        });
+        std::fill(cursor.begin(), cursor.end(), 0);
+        // A stream looks its vehicle up once and keeps the reference
+        std::vector<VehicleState*> states(vehicles);
+        for (int32_t vehicle_id = 0; vehicle_id < vehicles; ++vehicle_id) {
+            states[vehicle_id] = &table.get(vehicle_id);
+        }
+        double after = measureThroughput(threads, duration, [&](int t, std::mt19937&) {
+            int64_t c = cursor[t * 8];
+            states[next_vehicle(t)]->record(LocationPoint{c, 51.0, 19.0});
+        });
+        if (threads == 1) {
+            single_thread = after;
+        }
+        std::printf("%8d %16.0f %16.0f %9.2fx\n", threads, before, after, after / single_thread);
+    }
+    return 0;
+}
@@ -0,0 +1,247 @@
+// PackageStore benchmarks.
+//
+//   lookup      getPackageStatus latency as the store grows from 10k to
+//               10M packages, against the original linear scan over a
+//               vector of packages.
+//   contention  mixed status reads, transitions and creates from 1..N
+//               threads, against one unordered_map behind a single
+//               service-wide mutex (the design before lock striping).
+//   create      packages/s created and queued for dispatch from 1..N
+//               threads, as createPackages does it (createBatch + pushAll)
+//               against one createPackage per package (create + push).
+//
+// Usage: package_store_bench [--max-size=10000000] [--max-threads=16] [--duration-ms=1000]
+//                            [--batch-size=1000] [--create-count=1000000]
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "bench_util.h"
+#include "package_store.h"
+
+using packages::PackageData;
+using packages::PackageStatus;
+
+namespace {
+
+// The original store: every package in one vector, found by linear scan.
+class LinearStore {
+public:
+    void add(const Package& pkg) { packages_.push_back(pkg); }
+
+    std::optional<PackageStatus> status(int32_t package_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (const Package& pkg : packages_) {
+            if (pkg.package_id == package_id) {
+                return pkg.status;
+            }
+        }
+        return std::nullopt;
+    }
+
+private:
+    std::mutex mutex_;
+    std::vector<Package> packages_;
+};
+
+// Indexed, but every call takes the one service-wide mutex.
+class GlobalLockStore {
+public:
+    int32_t create(const PackageData& data) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        int32_t package_id = next_id_++;
+        packages_.emplace(package_id, Package{package_id, -1, data.sender_address(), data.recipient_address(),
+                                              PackageStatus::CREATED, destinationOf(data)});
+        return package_id;
+    }
+
+    std::optional<PackageStatus> status(int32_t package_id) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = packages_.find(package_id);
+        if (it == packages_.end()) {
+            return std::nullopt;
+        }
+        return it->second.status;
+    }
+
+    bool transition(int32_t package_id, PackageStatus from, PackageStatus to) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = packages_.find(package_id);
+        if (it == packages_.end() || it->second.status != from) {
+            return false;
+        }
+        it->second.status = to;
+        return true;
+    }
+
+private:
+    std::mutex mutex_;
+    int32_t next_id_ = 1;
+    std::unordered_map<int32_t, Package> packages_;
+};
+
+PackageData samplePackage(int32_t i) {
+    PackageData data;
+    data.set_sender_address("Sender Street " + std::to_string(i % 100));
+    data.set_recipient_address("Recipient Ave " + std::to_string(i));
+    data.mutable_destination()->set_latitude(50.0 + (i % 2000) * 0.001);
+    data.mutable_destination()->set_longitude(18.0 + (i / 2000 % 2000) * 0.001);
+    return data;
+}
+
+void fill(PackageStore& store, size_t count) {
+    google::protobuf::RepeatedPtrField<PackageData> batch;
+    for (size_t created = 0; created < count;) {
+        batch.Clear();
+        size_t n = std::min<size_t>(10000, count - created);
+        for (size_t i = 0; i < n; ++i) {
+            *batch.Add() = samplePackage(static_cast<int32_t>(created + i));
+        }
+        store.createBatch(batch);
+        created += n;
+    }
+}
+
+void printLatency(const char* name, size_t size, const Latency& latency) {
+    std::printf("%-12s %10zu  p50 %9.0f ns  p99 %9.0f ns  p99.9 %9.0f ns\n", name, size, latency.p50_ns,
+                latency.p99_ns, latency.p999_ns);
+}
+
+void benchLookup(size_t max_size) {
+    std::printf("== lookup: getPackageStatus latency by store size ==\n");
+    std::mt19937 rng(42);
+    for (size_t size = 10000; size <= max_size; size *= 10) {
+        PackageStore store;
+        fill(store, size);
+        std::uniform_int_distribution<int32_t> id(1, static_cast<int32_t>(size));
+        auto latency = measureLatency(200000, rng, [&](std::mt19937& r) {
+            volatile auto status = store.status(id(r));
+            (void)status;
+        });
+        printLatency("store", size, latency);
+
+        // The scan is O(n) per lookup, so it gets fewer samples and stops at 1M
+        if (size <= 1000000) {
+            LinearStore linear;
+            for (size_t i = 0; i < size; ++i) {
+                linear.add(Package{static_cast<int>(i + 1), -1, "", "", PackageStatus::CREATED, std::nullopt});
+            }
+            auto scan = measureLatency(size <= 100000 ? 2000 : 200, rng, [&](std::mt19937& r) {
+                volatile auto status = linear.status(id(r));
+                (void)status;
+            });
+            printLatency("linear scan", size, scan);
+        }
+    }
+}
+
+// 90% status reads, 5% CREATED <-> IN_TRANSIT transitions, 5% creates
+template <typename Store>
+double mixedWorkload(Store& store, int32_t size, int threads, std::chrono::milliseconds duration) {
+    const PackageData data = samplePackage(0);
+    return measureThroughput(threads, duration, [&](int, std::mt19937& rng) {
+        uint32_t r = rng();
+        int32_t package_id = 1 + static_cast<int32_t>((r >> 8) % size);
+        switch (r % 20) {
+            case 0:
+                store.create(data);
+                break;
+            case 1:
+                if (!store.transition(package_id, PackageStatus::CREATED, PackageStatus::IN_TRANSIT)) {
+                    store.transition(package_id, PackageStatus::IN_TRANSIT, PackageStatus::CREATED);
+                }
+                break;
+            default: {
+                volatile auto status = store.status(package_id);
+                (void)status;
+            }
+        }
+    });
+}
+
+void benchContention(const std::vector<int>& thread_counts, std::chrono::milliseconds duration) {
+    std::printf("== contention: mixed ops/s, 100k packages (90%% reads, 5%% transitions, 5%% creates) ==\n");
+    std::printf("%8s %16s %16s\n", "threads", "global mutex", "striped store");
+    const int32_t size = 100000;
+    for (int threads : thread_counts) {
+        GlobalLockStore global;
+        PackageStore striped;
+        for (int32_t i = 0; i < size; ++i) {
+            global.create(samplePackage(i));
+        }
+        fill(striped, size);
+        double before = mixedWorkload(global, size, threads, duration);
+        double after = mixedWorkload(striped, size, threads, duration);
+        std::printf("%8d %16.0f %16.0f\n", threads, before, after);
+    }
+}
+
+// Creates `total` packages split over `threads` threads, in batches of
+// `batch_size`, and returns packages per second. Each run starts from an
+// empty store and queue, so both sides pay the same growth costs.
+double createRate(int threads, size_t total, size_t batch_size, bool batched) {
+    PackageStore store;
+    ReadyQueue queue;
+    google::protobuf::RepeatedPtrField<PackageData> batch;
+    for (size_t i = 0; i < batch_size; ++i) {
+        *batch.Add() = samplePackage(static_cast<int32_t>(i));
+    }
+    const size_t batches_per_thread = total / batch_size / threads;
+
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&]() {
+            std::vector<ReadyPackage> ready;
+            while (!go.load(std::memory_order_acquire)) {
+                std::this_thread::yield();
+            }
+            for (size_t b = 0; b < batches_per_thread; ++b) {
+                if (batched) {
+                    int32_t first_id = store.createBatch(batch);
+                    ready.clear();
+                    for (int32_t i = 0; i < batch.size(); ++i) {
+                        ready.push_back(ReadyPackage{first_id + i, destinationOf(batch.Get(i))});
+                    }
+                    queue.pushAll(ready);
+                } else {
+                    for (const PackageData& data : batch) {
+                        Package pkg = store.create(data);
+                        queue.push(ReadyPackage{pkg.package_id, pkg.destination});
+                    }
+                }
+            }
+        });
+    }
+    auto start = BenchClock::now();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(BenchClock::now() - start).count();
+    return batches_per_thread * batch_size * threads / seconds;
+}
+
+void benchCreate(const std::vector<int>& thread_counts, size_t batch_size, size_t total) {
+    std::printf("== create: packages/s, %zu packages in batches of %zu ==\n", total, batch_size);
+    std::printf("%8s %16s %16s %10s\n", "threads", "create + push", "createBatch", "speedup");
+    for (int threads : thread_counts) {
+        double repeated = createRate(threads, total, batch_size, false);
+        double batched = createRate(threads, total, batch_size, true);
+        std::printf("%8d %16.0f %16.0f %9.2fx\n", threads, repeated, batched, batched / repeated);
+    }
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t max_size = argValue(argc, argv, "max-size", 10000000);
+    std::chrono::milliseconds duration(argValue(argc, argv, "duration-ms", 1000));
+    std::printf("hardware threads: %u\n", std::thread::hardware_concurrency());
+    benchLookup(max_size);
+    benchContention(threadCounts(argc, argv), duration);
+    benchCreate(threadCounts(argc, argv), std::max(1L, argValue(argc, argv, "batch-size", 1000)),
+                argValue(argc, argv, "create-count", 1000000));
+    return 0;
+}
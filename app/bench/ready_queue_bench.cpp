@@ -0,0 +1,75 @@
+// ReadyQueue assignment benchmark: latency of handing the nearest pending
+// package to a vehicle at its position, with 10k to 1M packages waiting,
+// against a linear nearest-neighbour scan over the same destinations.
+//
+// Usage: ready_queue_bench [--max-size=1000000] [--samples=20000]
+
+#include <cmath>
+#include <limits>
+
+#include "bench_util.h"
+#include "package_store.h"
+
+namespace {
+
+// Destinations spread over the same 2x2 degree area the customer uses
+GeoPoint randomPoint(std::mt19937& rng) {
+    std::uniform_real_distribution<double> lat(50.0, 52.0);
+    std::uniform_real_distribution<double> lon(18.0, 20.0);
+    return GeoPoint{lat(rng), lon(rng)};
+}
+
+int32_t linearNearest(const std::vector<GeoPoint>& points, GeoPoint origin) {
+    const double lon_scale = std::cos(origin.latitude * M_PI / 180.0);
+    double best = std::numeric_limits<double>::infinity();
+    int32_t best_id = -1;
+    for (size_t i = 0; i < points.size(); ++i) {
+        double dy = points[i].latitude - origin.latitude;
+        double dx = (points[i].longitude - origin.longitude) * lon_scale;
+        double d = dx * dx + dy * dy;
+        if (d < best) {
+            best = d;
+            best_id = static_cast<int32_t>(i);
+        }
+    }
+    return best_id;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    size_t max_size = argValue(argc, argv, "max-size", 1000000);
+    size_t samples = argValue(argc, argv, "samples", 20000);
+    std::printf("== assignment: nearest pending package for a vehicle position ==\n");
+    std::mt19937 rng(7);
+    for (size_t size = 10000; size <= max_size; size *= 10) {
+        ReadyQueue queue;
+        std::vector<ReadyPackage> pending;
+        std::vector<GeoPoint> points;
+        pending.reserve(size);
+        points.reserve(size);
+        for (size_t i = 0; i < size; ++i) {
+            GeoPoint point = randomPoint(rng);
+            pending.push_back(ReadyPackage{static_cast<int32_t>(i), point});
+            points.push_back(point);
+        }
+        queue.pushAll(pending);
+
+        // Every popped package is pushed back, so the queue stays at `size`
+        uint64_t ticket = 0;
+        auto latency = measureLatency(samples, rng, [&](std::mt19937& r) {
+            int32_t package_id = queue.popOrWait(randomPoint(r), [](int32_t) {}, &ticket);
+            queue.push(ReadyPackage{package_id, points[package_id]});
+        });
+        std::printf("%-12s %10zu  p50 %9.0f ns  p99 %9.0f ns  p99.9 %9.0f ns\n", "grid", size, latency.p50_ns,
+                    latency.p99_ns, latency.p999_ns);
+
+        auto scan = measureLatency(std::min<size_t>(samples, 500), rng, [&](std::mt19937& r) {
+            volatile int32_t package_id = linearNearest(points, randomPoint(r));
+            (void)package_id;
+        });
+        std::printf("%-12s %10zu  p50 %9.0f ns  p99 %9.0f ns  p99.9 %9.0f ns\n", "linear scan", size, scan.p50_ns,
+                    scan.p99_ns, scan.p999_ns);
+    }
+    return 0;
+}
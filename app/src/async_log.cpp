@@ -0,0 +1,250 @@
+#include "async_log.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace logs_api = opentelemetry::logs;
+namespace trace_api = opentelemetry::trace;
+
+std::atomic<uint8_t> AsyncLog::min_level_{static_cast<uint8_t>(LogLevel::kInfo)};
+
+namespace {
+
+struct Record {
+    LogLevel level = LogLevel::kInfo;
+    std::chrono::system_clock::time_point time;
+    bool has_context = false;
+    trace_api::TraceId trace_id;
+    trace_api::SpanId span_id;
+    trace_api::TraceFlags trace_flags;
+    std::string text;
+};
+
+// Records of one thread. Only that thread pushes and only the writer drains.
+class LogRing {
+public:
+    explicit LogRing(size_t capacity) : slots_(std::max<size_t>(capacity, 1)) {}
+
+    bool push(Record&& record) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == slots_.size()) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        slots_[head % slots_.size()] = std::move(record);
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void drain(std::vector<Record>& out) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_acquire);
+        for (; tail != head; ++tail) {
+            out.push_back(std::move(slots_[tail % slots_.size()]));
+        }
+        tail_.store(tail, std::memory_order_release);
+    }
+
+    uint64_t takeDropped() { return dropped_.exchange(0, std::memory_order_relaxed); }
+
+    std::atomic<bool> retired{false};
+
+private:
+    std::vector<Record> slots_;
+    std::atomic<uint64_t> dropped_{0};
+    alignas(64) std::atomic<size_t> head_{0};
+    alignas(64) std::atomic<size_t> tail_{0};
+};
+
+struct Writer {
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::vector<std::shared_ptr<LogRing>> rings;
+    AsyncLog::Options options;
+    opentelemetry::nostd::shared_ptr<logs_api::Logger> logger;
+    bool stopping = false;
+    std::thread thread;
+};
+
+Writer& writer() {
+    static Writer* instance = new Writer();
+    return *instance;
+}
+
+// The ring is registered on the thread's first record and retired when
+// the thread exits; the writer drops it after draining what is left.
+struct ThreadRing {
+    std::shared_ptr<LogRing> ring;
+
+    ~ThreadRing() {
+        if (ring) {
+            ring->retired.store(true, std::memory_order_release);
+        }
+    }
+};
+
+LogRing& threadRing() {
+    thread_local ThreadRing local;
+    if (!local.ring) {
+        Writer& w = writer();
+        std::lock_guard<std::mutex> lock(w.mutex);
+        local.ring = std::make_shared<LogRing>(w.options.ring_capacity);
+        w.rings.push_back(local.ring);
+    }
+    return *local.ring;
+}
+
+const char* levelName(LogLevel level) {
+    switch (level) {
+        case LogLevel::kDebug: return "DEBUG";
+        case LogLevel::kInfo: return "INFO";
+        case LogLevel::kWarn: return "WARN";
+        case LogLevel::kError: return "ERROR";
+    }
+    return "INFO";
+}
+
+logs_api::Severity severityOf(LogLevel level) {
+    switch (level) {
+        case LogLevel::kDebug: return logs_api::Severity::kDebug;
+        case LogLevel::kInfo: return logs_api::Severity::kInfo;
+        case LogLevel::kWarn: return logs_api::Severity::kWarn;
+        case LogLevel::kError: return logs_api::Severity::kError;
+    }
+    return logs_api::Severity::kInfo;
+}
+
+// Drains every ring and writes the records out in time order.
+void flushRecords() {
+    Writer& w = writer();
+    std::vector<Record> records;
+    uint64_t dropped = 0;
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        for (auto& ring : w.rings) {
+            // Read retired first, so records pushed before the thread exited are drained
+            bool retired = ring->retired.load(std::memory_order_acquire);
+            ring->drain(records);
+            dropped += ring->takeDropped();
+            if (retired) {
+                ring.reset();
+            }
+        }
+        w.rings.erase(std::remove(w.rings.begin(), w.rings.end(), nullptr), w.rings.end());
+    }
+    std::stable_sort(records.begin(), records.end(),
+                     [](const Record& a, const Record& b) { return a.time < b.time; });
+
+    if (w.options.console) {
+        std::string out;
+        std::string err;
+        for (const Record& record : records) {
+            std::string& target = record.level == LogLevel::kError ? err : out;
+            target += record.text;
+            target += '\n';
+        }
+        if (dropped > 0) {
+            err += "[LOG] Dropped " + std::to_string(dropped) + " records\n";
+        }
+        if (!out.empty()) {
+            std::fwrite(out.data(), 1, out.size(), stdout);
+            std::fflush(stdout);
+        }
+        if (!err.empty()) {
+            std::fwrite(err.data(), 1, err.size(), stderr);
+        }
+    }
+    if (w.logger) {
+        for (const Record& record : records) {
+            auto timestamp = opentelemetry::common::SystemTimestamp(record.time);
+            if (record.has_context) {
+                w.logger->EmitLogRecord(severityOf(record.level), record.text, record.trace_id, record.span_id,
+                                        record.trace_flags, timestamp);
+            } else {
+                w.logger->EmitLogRecord(severityOf(record.level), record.text, timestamp);
+            }
+        }
+    }
+}
+
+void run() {
+    Writer& w = writer();
+    std::unique_lock<std::mutex> lock(w.mutex);
+    while (!w.stopping) {
+        w.cv.wait_for(lock, w.options.flush_interval, [&w]() { return w.stopping; });
+        lock.unlock();
+        flushRecords();
+        lock.lock();
+    }
+}
+
+}  // namespace
+
+AsyncLog::Options AsyncLog::Options::fromEnv() {
+    Options options;
+    if (const char* level = std::getenv("LOG_LEVEL")) {
+        if (std::strcmp(level, "debug") == 0) {
+            options.level = LogLevel::kDebug;
+        } else if (std::strcmp(level, "warn") == 0) {
+            options.level = LogLevel::kWarn;
+        } else if (std::strcmp(level, "error") == 0) {
+            options.level = LogLevel::kError;
+        } else {
+            options.level = LogLevel::kInfo;
+        }
+    }
+    if (const char* console = std::getenv("LOG_CONSOLE")) {
+        options.console = std::strcmp(console, "0") != 0;
+    }
+    if (const char* flush_ms = std::getenv("LOG_FLUSH_MS")) {
+        options.flush_interval = std::chrono::milliseconds(std::max(1, std::atoi(flush_ms)));
+    }
+    return options;
+}
+
+void AsyncLog::start(const Options& options, opentelemetry::nostd::shared_ptr<logs_api::Logger> logger) {
+    Writer& w = writer();
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.options = options;
+        w.logger = std::move(logger);
+        w.stopping = false;
+    }
+    min_level_.store(static_cast<uint8_t>(options.level), std::memory_order_relaxed);
+    w.thread = std::thread(run);
+}
+
+void AsyncLog::stop() {
+    Writer& w = writer();
+    {
+        std::lock_guard<std::mutex> lock(w.mutex);
+        w.stopping = true;
+    }
+    w.cv.notify_one();
+    if (w.thread.joinable()) {
+        w.thread.join();
+    }
+    flushRecords();
+}
+
+void AsyncLog::write(LogLevel level, std::string text, const trace_api::SpanContext* context) {
+    Record record;
+    record.level = level;
+    record.time = std::chrono::system_clock::now();
+    if (context) {
+        record.has_context = true;
+        record.trace_id = context->trace_id();
+        record.span_id = context->span_id();
+        record.trace_flags = context->trace_flags();
+    }
+    record.text = std::move(text);
+    threadRing().push(std::move(record));
+}
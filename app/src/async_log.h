@@ -0,0 +1,78 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <sstream>
+#include <string>
+
+#include "opentelemetry/logs/logger.h"
+#include "opentelemetry/trace/span_context.h"
+
+enum class LogLevel : uint8_t { kDebug, kInfo, kWarn, kError };
+
+// Asynchronous, level-filtered log used on the servers' hot paths.
+//
+// The LOG_* macros check the level before evaluating or formatting their
+// message, so disabled records cost one relaxed load. Enabled records are
+// pushed into a ring owned by the calling thread (single producer, single
+// consumer, no lock) and a background writer drains every ring each
+// flush interval: it prints them to the console in one write, if console
+// output is on, and hands them to the OTel logger. A full ring drops the
+// record instead of blocking; drops are reported by the writer.
+class AsyncLog {
+public:
+    struct Options {
+        LogLevel level = LogLevel::kInfo;
+        bool console = true;
+        std::chrono::milliseconds flush_interval{100};
+        size_t ring_capacity = 4096;
+
+        // LOG_LEVEL (debug, info, warn, error), LOG_CONSOLE=0 and
+        // LOG_FLUSH_MS override the defaults.
+        static Options fromEnv();
+    };
+
+    // Starts the writer. Records also go to `logger` when it is set.
+    static void start(const Options& options, opentelemetry::nostd::shared_ptr<opentelemetry::logs::Logger> logger);
+
+    // Writes out everything logged so far and stops the writer.
+    static void stop();
+
+    static bool enabled(LogLevel level) {
+        return static_cast<uint8_t>(level) >= min_level_.load(std::memory_order_relaxed);
+    }
+
+    static void write(LogLevel level, std::string text, const opentelemetry::trace::SpanContext* context = nullptr);
+
+    // Empty formatting stream of the calling thread, reused between records.
+    static std::ostringstream& stream() {
+        thread_local std::ostringstream stream;
+        stream.str(std::string());
+        return stream;
+    }
+
+private:
+    static std::atomic<uint8_t> min_level_;
+};
+
+#define LOG_AT(level, context, message)                           \
+    do {                                                          \
+        if (AsyncLog::enabled(level)) {                           \
+            std::ostringstream& log_stream_ = AsyncLog::stream(); \
+            log_stream_ << message;                               \
+            AsyncLog::write(level, log_stream_.str(), context);   \
+        }                                                         \
+    } while (false)
+
+#define LOG_DEBUG(message) LOG_AT(LogLevel::kDebug, nullptr, message)
+#define LOG_INFO(message) LOG_AT(LogLevel::kInfo, nullptr, message)
+#define LOG_WARN(message) LOG_AT(LogLevel::kWarn, nullptr, message)
+#define LOG_ERROR(message) LOG_AT(LogLevel::kError, nullptr, message)
+
+// Same, correlated with a span
+#define LOG_SPAN_DEBUG(span_context, message) LOG_AT(LogLevel::kDebug, &(span_context), message)
+#define LOG_SPAN_INFO(span_context, message) LOG_AT(LogLevel::kInfo, &(span_context), message)
+#define LOG_SPAN_WARN(span_context, message) LOG_AT(LogLevel::kWarn, &(span_context), message)
+#define LOG_SPAN_ERROR(span_context, message) LOG_AT(LogLevel::kError, &(span_context), message)
@@ -3,10 +3,16 @@
 #include <vector>
 #include <chrono>
 #include <random>
+#include <algorithm>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
 
 #include <grpcpp/grpcpp.h>
 #include <grpc/grpc.h>
 #include "package_service.grpc.pb.h"
+#include "telemetry.h"
 
 using grpc::Channel;
 using grpc::ClientContext;
@@ -15,9 +21,13 @@ using grpc::Status;
 using packages::PackageService;
 using packages::PackageData;
 using packages::PackageResponse;
+using packages::PackageBatch;
+using packages::PackageBatchResponse;
 using packages::PackageStatusRequest;
 using packages::PackageStatusResponse;
 using packages::PackageStatus;
+using packages::PackageWatchRequest;
+using packages::PackageStatusEvent;
 
 class PackageClient {
 public:
@@ -28,6 +38,7 @@ public:
 		PackageData request;
 		request.set_sender_address(from);
 		request.set_recipient_address(to);
+		SetRandomDestination(request.mutable_destination());
 
 		PackageResponse response;
 		ClientContext context;
@@ -42,6 +53,27 @@ public:
 		}
 	}
 
+    std::vector<int> CreatePackages(const std::string& from, const std::string& to, int count) {
+		PackageBatch request;
+		for (int i = 0; i < count; ++i) {
+			PackageData* data = request.add_packages();
+			data->set_sender_address(from);
+			data->set_recipient_address(to);
+			SetRandomDestination(data->mutable_destination());
+		}
+
+		PackageBatchResponse response;
+		ClientContext context;
+
+		Status status = stub_->createPackages(&context, request, &response);
+		if (!status.ok()) {
+			std::cerr << "[!] Failed to create packages: " << status.error_message() << std::endl;
+			return {};
+		}
+		std::cout << "[+] Created " << response.package_ids_size() << " packages" << std::endl;
+		return std::vector<int>(response.package_ids().begin(), response.package_ids().end());
+	}
+
     void GetStatus(int package_id) {
 		PackageStatusRequest request;
 		request.set_package_id(package_id);
@@ -58,15 +90,108 @@ public:
 		}
 	}
 
+    // Blocks until every watched package is delivered or the stream breaks
+    void WatchPackages(const std::vector<int>& package_ids) {
+		PackageWatchRequest request;
+		for (int id : package_ids) {
+			request.add_package_ids(id);
+		}
+
+		ClientContext context;
+		std::unique_ptr<grpc::ClientReader<PackageStatusEvent>> reader(stub_->watchPackages(&context, request));
+
+		PackageStatusEvent event;
+		while (reader->Read(&event)) {
+			std::cout << "[~] Package " << event.package_id() << " is now " << PackageStatus_Name(event.status());
+			if (event.status() == PackageStatus::DELIVERED) {
+				std::cout << " (vehicle " << event.delivered_by() << ")";
+			}
+			std::cout << std::endl;
+		}
+
+		Status status = reader->Finish();
+		if (!status.ok()) {
+			std::cerr << "[!] Watch of " << package_ids.size() << " packages failed: " << status.error_message() << std::endl;
+		}
+	}
+
 private:
     std::unique_ptr<PackageService::Stub> stub_;
+    std::default_random_engine rng_{std::random_device{}()};
+
+    void SetRandomDestination(packages::GeoPoint* destination) {
+		std::uniform_real_distribution<double> lat_dist(50.0, 52.0);
+		std::uniform_real_distribution<double> lon_dist(18.0, 20.0);
+		destination->set_latitude(lat_dist(rng_));
+		destination->set_longitude(lon_dist(rng_));
+	}
+};
+
+// Follows created packages over a fixed number of watchPackages streams.
+// Each stream thread takes every id queued so far (up to the server's
+// batch limit) and watches them until delivered, so threads and streams
+// stay bounded however far delivery falls behind creation.
+class PackageWatchers {
+public:
+    PackageWatchers(PackageClient& client, int streams) : client_(client) {
+        for (int i = 0; i < streams; ++i) {
+            threads_.emplace_back([this]() { Run(); });
+        }
+    }
+
+    void Add(const std::vector<int>& package_ids) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            pending_.insert(pending_.end(), package_ids.begin(), package_ids.end());
+        }
+        cv_.notify_one();
+    }
+
+private:
+    static constexpr size_t kMaxIdsPerStream = 10000;
+
+    void Run() {
+        while (true) {
+            std::vector<int> ids;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                cv_.wait(lock, [this]() { return !pending_.empty(); });
+                size_t count = std::min(pending_.size(), kMaxIdsPerStream);
+                ids.assign(pending_.begin(), pending_.begin() + count);
+                pending_.erase(pending_.begin(), pending_.begin() + count);
+            }
+            client_.WatchPackages(ids);
+        }
+    }
+
+    PackageClient& client_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::deque<int> pending_;
+    std::vector<std::thread> threads_;
 };
 
 int main() {
+    initTelemetry(TelemetryOptions::fromEnv("customer-client"));
     std::string target = "package-service:50052";
     auto channel = grpc::CreateChannel(target, grpc::InsecureChannelCredentials());
     PackageClient client(channel);
 
+    // CUSTOMER_BATCH_SIZE > 1 creates packages through createPackages in bursts of that size
+    const char* batch_env = std::getenv("CUSTOMER_BATCH_SIZE");
+    int batch_size = batch_env ? std::max(1, std::atoi(batch_env)) : 1;
+
+    // CUSTOMER_WATCH=1 follows created packages through watchPackages instead of polling getPackageStatus
+    const char* watch_env = std::getenv("CUSTOMER_WATCH");
+    bool watch = watch_env && std::string(watch_env) == "1";
+
+    // CUSTOMER_WATCH_STREAMS caps the concurrent watchPackages streams
+    const char* streams_env = std::getenv("CUSTOMER_WATCH_STREAMS");
+    std::unique_ptr<PackageWatchers> watchers;
+    if (watch) {
+        watchers = std::make_unique<PackageWatchers>(client, streams_env ? std::max(1, std::atoi(streams_env)) : 4);
+    }
+
     std::vector<int> package_ids;
 
     std::default_random_engine rng(std::random_device{}());
@@ -77,13 +202,26 @@ int main() {
     while (true) {
         int action = choose_action(rng);
 
-        if (action == 0) {
+        if (action == 0 && watch) {
+            std::vector<int> ids = batch_size > 1
+                ? client.CreatePackages("Sender Street 1", "Recipient Ave 9", batch_size)
+                : std::vector<int>{client.CreatePackage("Sender Street 1", "Recipient Ave 9")};
+            if (!ids.empty() && ids.front() != -1) {
+                watchers->Add(ids);
+            }
+        } else if (action == 0 && batch_size > 1) {
+            std::vector<int> ids = client.CreatePackages("Sender Street 1", "Recipient Ave 9", batch_size);
+            if (!ids.empty()) {
+                package_ids.insert(package_ids.end(), ids.begin(), ids.end());
+                choose_index = std::uniform_int_distribution<int>(0, package_ids.size() - 1);
+            }
+        } else if (action == 0) {
             int id = client.CreatePackage("Sender Street 1", "Recipient Ave 9");
             if (id != -1) {
                 package_ids.push_back(id);
                 choose_index = std::uniform_int_distribution<int>(0, package_ids.size() - 1);
             }
-        } else if (!package_ids.empty()) {
+        } else if (!watch && !package_ids.empty()) {
             int id = package_ids[choose_index(rng)];
             client.GetStatus(id);
         }
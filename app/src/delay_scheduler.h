@@ -0,0 +1,116 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Runs callbacks after a delay, so callback reactors can pause between
+// steps without parking a thread per call. A single timer thread waits
+// for the deadlines and hands due callbacks to a small worker pool, so
+// the work a callback does never holds up the callbacks due after it.
+// Callbacks run outside the scheduler locks and may schedule further work.
+class DelayScheduler {
+public:
+    explicit DelayScheduler(size_t workers = std::max(2u, std::thread::hardware_concurrency())) {
+        timer_ = std::thread([this]() { runTimer(); });
+        for (size_t i = 0; i < workers; ++i) {
+            workers_.emplace_back([this]() { runWorker(); });
+        }
+    }
+
+    ~DelayScheduler() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        timer_.join();
+        {
+            std::lock_guard<std::mutex> lock(ready_mutex_);
+            stopping_workers_ = true;
+        }
+        ready_cv_.notify_all();
+        for (std::thread& worker : workers_) {
+            worker.join();
+        }
+    }
+
+    void schedule(std::chrono::milliseconds delay, std::function<void()> fn) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            queue_.push(Entry{std::chrono::steady_clock::now() + delay, next_seq_++, std::move(fn)});
+        }
+        cv_.notify_one();
+    }
+
+private:
+    struct Entry {
+        std::chrono::steady_clock::time_point due;
+        uint64_t seq;
+        std::function<void()> fn;
+
+        bool operator>(const Entry& other) const {
+            return due != other.due ? due > other.due : seq > other.seq;
+        }
+    };
+
+    void runTimer() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            if (queue_.empty()) {
+                cv_.wait(lock);
+                continue;
+            }
+            auto due = queue_.top().due;
+            if (std::chrono::steady_clock::now() < due) {
+                cv_.wait_until(lock, due);
+                continue;
+            }
+            auto fn = std::move(const_cast<Entry&>(queue_.top()).fn);
+            queue_.pop();
+            {
+                std::lock_guard<std::mutex> ready_lock(ready_mutex_);
+                ready_.push_back(std::move(fn));
+            }
+            ready_cv_.notify_one();
+        }
+    }
+
+    void runWorker() {
+        std::unique_lock<std::mutex> lock(ready_mutex_);
+        while (true) {
+            ready_cv_.wait(lock, [this]() { return stopping_workers_ || !ready_.empty(); });
+            if (stopping_workers_) {
+                return;
+            }
+            auto fn = std::move(ready_.front());
+            ready_.pop_front();
+            lock.unlock();
+            fn();
+            lock.lock();
+        }
+    }
+
+    // Pending callbacks by deadline, guarded by mutex_
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> queue_;
+    uint64_t next_seq_ = 0;
+    bool stopping_ = false;
+
+    // Due callbacks waiting for a worker, guarded by ready_mutex_
+    std::mutex ready_mutex_;
+    std::condition_variable ready_cv_;
+    std::deque<std::function<void()>> ready_;
+    bool stopping_workers_ = false;
+
+    std::thread timer_;
+    std::vector<std::thread> workers_;
+};
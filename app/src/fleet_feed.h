@@ -0,0 +1,154 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "location_history.h"
+#include "vehicle_service.pb.h"
+#include "vehicle_table.h"
+
+// Receives fleet frames. Called with the feed lock held, so it must not
+// block. Returning false drops the frame, and the subscriber is sent a
+// fresh snapshot on the next tick instead of further deltas.
+class FleetSubscriber {
+public:
+    virtual ~FleetSubscriber() = default;
+    virtual bool onFleetFrame(std::shared_ptr<const vehicle::FleetFrame> frame) = 0;
+};
+
+// Latest positions of the whole fleet as a stream of frames. Ingest does
+// not touch the feed: once per tick a background thread reads the
+// per-vehicle latest-point slots in the VehicleTable whose version
+// changed, folds them into the known positions and builds a single delta
+// frame of the vehicles whose position changed, which every subscriber
+// shares. New subscribers get a snapshot of all known positions, built at
+// most once per tick and shared the same way.
+class FleetFeed {
+public:
+    FleetFeed(const VehicleTable& vehicles, std::chrono::milliseconds tick)
+        : vehicles_(vehicles), tick_interval_(tick), thread_([this]() { run(); }) {}
+
+    ~FleetFeed() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+
+    // Sends the current snapshot right away, then a delta every tick.
+    void subscribe(FleetSubscriber* subscriber) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        subscribers_[subscriber] = !subscriber->onFleetFrame(snapshotLocked());
+    }
+
+    // The subscriber gets no further calls once this returns.
+    void unsubscribe(FleetSubscriber* subscriber) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        subscribers_.erase(subscriber);
+    }
+
+private:
+    static void setLocation(vehicle::Location* location, int32_t vehicle_id, const LocationPoint& point) {
+        location->set_vehicle_id(vehicle_id);
+        location->set_latitude(point.latitude);
+        location->set_longitude(point.longitude);
+        location->set_timestamp_ms(point.timestamp_ms);
+    }
+
+    std::shared_ptr<const vehicle::FleetFrame> snapshotLocked() {
+        if (!snapshot_) {
+            std::vector<int32_t> vehicle_ids;
+            vehicle_ids.reserve(positions_.size());
+            for (const auto& entry : positions_) {
+                vehicle_ids.push_back(entry.first);
+            }
+            std::sort(vehicle_ids.begin(), vehicle_ids.end());
+
+            auto frame = std::make_shared<vehicle::FleetFrame>();
+            frame->set_snapshot(true);
+            frame->set_tick(tick_);
+            frame->mutable_vehicles()->Reserve(vehicle_ids.size());
+            for (int32_t vehicle_id : vehicle_ids) {
+                setLocation(frame->add_vehicles(), vehicle_id, positions_[vehicle_id]);
+            }
+            snapshot_ = std::move(frame);
+        }
+        return snapshot_;
+    }
+
+    void tick() {
+        std::vector<std::pair<int32_t, LocationPoint>> moved;
+        vehicles_.forEach([&](int32_t vehicle_id, const VehicleState& vehicle) {
+            uint64_t& seen = versions_[vehicle_id];
+            if (!vehicle.changedSince(seen)) {
+                return;
+            }
+            if (auto point = vehicle.latest(&seen)) {
+                moved.emplace_back(vehicle_id, *point);
+            }
+        });
+        std::sort(moved.begin(), moved.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++tick_;
+        auto delta = std::make_shared<vehicle::FleetFrame>();
+        delta->set_tick(tick_);
+        for (const auto& [vehicle_id, point] : moved) {
+            auto it = positions_.find(vehicle_id);
+            bool changed = it == positions_.end() || it->second.latitude != point.latitude ||
+                           it->second.longitude != point.longitude;
+            positions_[vehicle_id] = point;
+            if (changed) {
+                setLocation(delta->add_vehicles(), vehicle_id, point);
+            }
+        }
+        if (!moved.empty()) {
+            snapshot_.reset();
+        }
+
+        for (auto& [subscriber, needs_snapshot] : subscribers_) {
+            if (needs_snapshot) {
+                needs_snapshot = !subscriber->onFleetFrame(snapshotLocked());
+            } else if (delta->vehicles_size() > 0) {
+                needs_snapshot = !subscriber->onFleetFrame(delta);
+            }
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            cv_.wait_for(lock, tick_interval_, [this]() { return stopping_; });
+            if (stopping_) {
+                break;
+            }
+            lock.unlock();
+            tick();
+            lock.lock();
+        }
+    }
+
+    const VehicleTable& vehicles_;
+    std::chrono::milliseconds tick_interval_;
+    // Slot version each vehicle was last read at; feed thread only
+    std::unordered_map<int32_t, uint64_t> versions_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    int64_t tick_ = 0;
+    std::unordered_map<int32_t, LocationPoint> positions_;
+    std::shared_ptr<const vehicle::FleetFrame> snapshot_;
+    // Subscriber -> whether its next frame must be a snapshot
+    std::unordered_map<FleetSubscriber*, bool> subscribers_;
+    std::thread thread_;
+};
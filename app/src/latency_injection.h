@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Artificial latency and failures for one injection point in a handler.
+// Each point is configured from the environment:
+//
+//   LATENCY_<POINT>=off | fixed:<ms> | uniform:<min_ms>:<max_ms>
+//                   | exponential:<mean_ms> | normal:<mean_ms>:<stddev_ms>
+//   LATENCY_<POINT>_ERROR_RATE=<0..1>
+//
+// and LATENCY_MODE=off turns every point off, for capacity benchmarks.
+// Unset points keep the default the service passes in. Draws come from a
+// per-thread engine, so policies can be shared between threads.
+class LatencyPolicy {
+public:
+    enum class Distribution { Off, Fixed, Uniform, Exponential, Normal };
+
+    static LatencyPolicy off() { return LatencyPolicy(Distribution::Off, 0, 0); }
+    static LatencyPolicy fixed(double ms) { return LatencyPolicy(Distribution::Fixed, ms, 0); }
+    static LatencyPolicy uniform(double min_ms, double max_ms) { return LatencyPolicy(Distribution::Uniform, min_ms, max_ms); }
+    static LatencyPolicy exponential(double mean_ms) { return LatencyPolicy(Distribution::Exponential, mean_ms, 0); }
+    static LatencyPolicy normal(double mean_ms, double stddev_ms) { return LatencyPolicy(Distribution::Normal, mean_ms, stddev_ms); }
+
+    static LatencyPolicy fromEnv(const std::string& point, LatencyPolicy fallback) {
+        const char* mode = std::getenv("LATENCY_MODE");
+        if (mode && std::string(mode) == "off") {
+            return off();
+        }
+        LatencyPolicy policy = fallback;
+        if (const char* spec = std::getenv(("LATENCY_" + point).c_str())) {
+            if (!parse(spec, &policy)) {
+                std::cerr << "[LATENCY] Ignoring invalid LATENCY_" << point << "=" << spec << std::endl;
+                policy = fallback;
+            }
+        }
+        if (const char* rate = std::getenv(("LATENCY_" + point + "_ERROR_RATE").c_str())) {
+            policy.error_rate_ = std::clamp(std::atof(rate), 0.0, 1.0);
+        }
+        return policy;
+    }
+
+    std::chrono::milliseconds draw() const {
+        double ms = 0;
+        switch (distribution_) {
+            case Distribution::Off:
+                return std::chrono::milliseconds(0);
+            case Distribution::Fixed:
+                ms = a_;
+                break;
+            case Distribution::Uniform:
+                ms = std::uniform_real_distribution<double>(a_, b_)(engine());
+                break;
+            case Distribution::Exponential:
+                ms = std::exponential_distribution<double>(1.0 / a_)(engine());
+                break;
+            case Distribution::Normal:
+                ms = std::normal_distribution<double>(a_, b_)(engine());
+                break;
+        }
+        return std::chrono::milliseconds(static_cast<int64_t>(std::max(0.0, ms)));
+    }
+
+    // Sleeps the calling thread for one draw. Only for synchronous handlers.
+    void sleep() const {
+        auto delay = draw();
+        if (delay.count() > 0) {
+            std::this_thread::sleep_for(delay);
+        }
+    }
+
+    // True when the caller should fail this call with an injected error.
+    bool shouldFail() const {
+        return error_rate_ > 0 && std::uniform_real_distribution<double>(0.0, 1.0)(engine()) < error_rate_;
+    }
+
+private:
+    LatencyPolicy(Distribution distribution, double a, double b) : distribution_(distribution), a_(a), b_(b) {}
+
+    static bool parse(const std::string& spec, LatencyPolicy* policy) {
+        std::vector<std::string> parts;
+        std::stringstream stream(spec);
+        std::string part;
+        while (std::getline(stream, part, ':')) {
+            parts.push_back(part);
+        }
+        if (parts.empty()) {
+            return false;
+        }
+        std::vector<double> args;
+        for (size_t i = 1; i < parts.size(); ++i) {
+            char* end = nullptr;
+            double value = std::strtod(parts[i].c_str(), &end);
+            if (parts[i].empty() || *end != '\0' || !std::isfinite(value) || value < 0) {
+                return false;
+            }
+            args.push_back(value);
+        }
+        const std::string& kind = parts[0];
+        if (kind == "off" && args.empty()) {
+            *policy = off();
+        } else if (kind == "fixed" && args.size() == 1) {
+            *policy = fixed(args[0]);
+        } else if (kind == "uniform" && args.size() == 2 && args[0] <= args[1]) {
+            *policy = uniform(args[0], args[1]);
+        } else if (kind == "exponential" && args.size() == 1 && args[0] > 0) {
+            *policy = exponential(args[0]);
+        } else if (kind == "normal" && args.size() == 2 && args[1] > 0) {
+            *policy = normal(args[0], args[1]);
+        } else {
+            return false;
+        }
+        return true;
+    }
+
+    static std::mt19937_64& engine() {
+        thread_local std::mt19937_64 engine{std::random_device{}()};
+        return engine;
+    }
+
+    Distribution distribution_;
+    double a_;
+    double b_;
+    double error_rate_ = 0;
+};
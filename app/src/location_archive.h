@@ -0,0 +1,740 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "location_history.h"
+
+// Sealed, read-only segment of the location archive, mapped into memory.
+//
+// Layout: a header, a directory of vehicles sorted by id, then the
+// timestamp, latitude and longitude columns. Each vehicle's points are a
+// contiguous run of the columns, sorted by timestamp, so the directory
+// doubles as the vehicle id column.
+class LocationSegment {
+public:
+    struct Header {
+        char magic[8];
+        uint32_t vehicle_count;
+        // Logs before locations-<seq>.log that the segment also replaces
+        uint32_t earlier_logs;
+        uint64_t point_count;
+        int64_t min_timestamp_ms;
+        int64_t max_timestamp_ms;
+    };
+
+    struct VehicleRun {
+        int32_t vehicle_id;
+        uint32_t point_count;
+        uint64_t first_point;
+    };
+
+    static constexpr char kMagic[8] = {'L', 'O', 'C', 'S', 'E', 'G', '0', '1'};
+
+    // Writes points grouped by vehicle to `path` through a temporary file.
+    static bool write(const std::string& path, const std::unordered_map<int32_t, std::vector<LocationPoint>>& points,
+                      uint32_t earlier_logs = 0) {
+        std::vector<int32_t> vehicle_ids;
+        vehicle_ids.reserve(points.size());
+        Header header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.min_timestamp_ms = INT64_MAX;
+        header.max_timestamp_ms = INT64_MIN;
+        header.earlier_logs = earlier_logs;
+        for (const auto& [vehicle_id, vehicle_points] : points) {
+            if (vehicle_points.empty()) {
+                continue;
+            }
+            vehicle_ids.push_back(vehicle_id);
+            header.point_count += vehicle_points.size();
+        }
+        std::sort(vehicle_ids.begin(), vehicle_ids.end());
+        header.vehicle_count = vehicle_ids.size();
+
+        std::vector<VehicleRun> runs;
+        std::vector<int64_t> timestamps;
+        std::vector<double> latitudes;
+        std::vector<double> longitudes;
+        runs.reserve(vehicle_ids.size());
+        timestamps.reserve(header.point_count);
+        latitudes.reserve(header.point_count);
+        longitudes.reserve(header.point_count);
+        for (int32_t vehicle_id : vehicle_ids) {
+            std::vector<LocationPoint> run = points.at(vehicle_id);
+            std::stable_sort(run.begin(), run.end(), [](const LocationPoint& a, const LocationPoint& b) {
+                return a.timestamp_ms < b.timestamp_ms;
+            });
+            runs.push_back(VehicleRun{vehicle_id, static_cast<uint32_t>(run.size()), timestamps.size()});
+            for (const LocationPoint& point : run) {
+                timestamps.push_back(point.timestamp_ms);
+                latitudes.push_back(point.latitude);
+                longitudes.push_back(point.longitude);
+            }
+            header.min_timestamp_ms = std::min(header.min_timestamp_ms, run.front().timestamp_ms);
+            header.max_timestamp_ms = std::max(header.max_timestamp_ms, run.back().timestamp_ms);
+        }
+
+        std::string tmp_path = path + ".tmp";
+        int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            return false;
+        }
+        bool ok = writeAll(fd, &header, sizeof(header)) &&
+                  writeAll(fd, runs.data(), runs.size() * sizeof(VehicleRun)) &&
+                  writeAll(fd, timestamps.data(), timestamps.size() * sizeof(int64_t)) &&
+                  writeAll(fd, latitudes.data(), latitudes.size() * sizeof(double)) &&
+                  writeAll(fd, longitudes.data(), longitudes.size() * sizeof(double)) &&
+                  ::fsync(fd) == 0;
+        ::close(fd);
+        if (!ok || std::rename(tmp_path.c_str(), path.c_str()) != 0) {
+            std::remove(tmp_path.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    // Maps a segment file. Returns nullptr if it is missing or malformed.
+    static std::shared_ptr<const LocationSegment> open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return nullptr;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(Header))) {
+            ::close(fd);
+            return nullptr;
+        }
+        void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            return nullptr;
+        }
+        std::shared_ptr<LocationSegment> segment(new LocationSegment(path, data, st.st_size));
+        const Header& header = segment->header();
+        size_t expected = sizeof(Header) + header.vehicle_count * sizeof(VehicleRun) +
+                          header.point_count * (sizeof(int64_t) + 2 * sizeof(double));
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 || static_cast<size_t>(st.st_size) != expected) {
+            return nullptr;
+        }
+        return segment;
+    }
+
+    ~LocationSegment() { ::munmap(data_, size_); }
+
+    LocationSegment(const LocationSegment&) = delete;
+    LocationSegment& operator=(const LocationSegment&) = delete;
+
+    const std::string& path() const { return path_; }
+
+    int64_t minTimestamp() const { return header().min_timestamp_ms; }
+
+    int64_t maxTimestamp() const { return header().max_timestamp_ms; }
+
+    uint64_t pointCount() const { return header().point_count; }
+
+    uint32_t earlierLogs() const { return header().earlier_logs; }
+
+    // Appends the vehicle's points with from_ms <= timestamp <= to_ms.
+    void collect(int32_t vehicle_id, int64_t from_ms, int64_t to_ms, std::vector<LocationPoint>& out) const {
+        if (to_ms < minTimestamp() || from_ms > maxTimestamp()) {
+            return;
+        }
+        const VehicleRun* runs_end = runs() + header().vehicle_count;
+        const VehicleRun* run = std::lower_bound(runs(), runs_end, vehicle_id,
+            [](const VehicleRun& r, int32_t id) { return r.vehicle_id < id; });
+        if (run == runs_end || run->vehicle_id != vehicle_id) {
+            return;
+        }
+        const int64_t* ts_begin = timestamps() + run->first_point;
+        const int64_t* ts_end = ts_begin + run->point_count;
+        const int64_t* first = std::lower_bound(ts_begin, ts_end, from_ms);
+        const int64_t* last = to_ms == INT64_MAX ? ts_end : std::upper_bound(first, ts_end, to_ms);
+        for (const int64_t* ts = first; ts != last; ++ts) {
+            size_t i = ts - timestamps();
+            out.push_back(LocationPoint{*ts, latitudes()[i], longitudes()[i]});
+        }
+    }
+
+private:
+    LocationSegment(std::string path, void* data, size_t size) : path_(std::move(path)), data_(data), size_(size) {}
+
+    static bool writeAll(int fd, const void* data, size_t size) {
+        const char* pos = static_cast<const char*>(data);
+        while (size > 0) {
+            ssize_t n = ::write(fd, pos, size);
+            if (n < 0) {
+                return false;
+            }
+            pos += n;
+            size -= n;
+        }
+        return true;
+    }
+
+    const char* bytes() const { return static_cast<const char*>(data_); }
+
+    const Header& header() const { return *reinterpret_cast<const Header*>(bytes()); }
+
+    const VehicleRun* runs() const { return reinterpret_cast<const VehicleRun*>(bytes() + sizeof(Header)); }
+
+    const int64_t* timestamps() const {
+        return reinterpret_cast<const int64_t*>(runs() + header().vehicle_count);
+    }
+
+    const double* latitudes() const { return reinterpret_cast<const double*>(timestamps() + header().point_count); }
+
+    const double* longitudes() const { return latitudes() + header().point_count; }
+
+    std::string path_;
+    void* data_;
+    size_t size_;
+};
+
+// Durable location history: every ingested point is kept on disk, beyond
+// what the in-memory rings hold and across restarts.
+//
+// Points are appended to an in-memory open segment and to a buffer that a
+// background thread writes sequentially to locations-<seq>.log every flush
+// interval, so ingest never waits on the disk. The open segment is split
+// into shards by vehicle id, each with its own lock, so ingest streams for
+// different vehicles rarely meet; only the flusher visits every shard.
+// Once a segment has been open for the segment window, or holds more than
+// the size cap, it is sealed: rewritten as a columnar locations-<seq>.seg
+// file, mapped, and its log deleted. A frame that fails to reach the
+// disk is cut off the log and retried, after a growing delay, in a fresh
+// log that continues the same segment. A segment that
+// fails to seal stays in memory, served to queries, and is retried on
+// every rotation. Queries read sealed segments straight from the
+// mappings. Startup maps the sealed segments as they are and seals the
+// log left by the previous run.
+// Points are archived with the timestamps LocationHistory filed them at,
+// so the archive and the in-memory history agree.
+class LocationArchive {
+public:
+    struct Options {
+        std::string dir;
+        std::chrono::milliseconds flush_interval{200};
+        std::chrono::seconds segment_window{900};
+        // Checked every flush interval, so a segment may pass it by one interval's worth of points
+        size_t segment_max_bytes = 64 << 20;
+        std::chrono::hours retention{72};
+    };
+
+    // VEHICLE_DATA_DIR enables persistence. VEHICLE_SEGMENT_FLUSH_MS and
+    // VEHICLE_SEGMENT_WINDOW_S tune the flush and sealing cadence,
+    // VEHICLE_SEGMENT_MAX_MB caps the open segment (default 64), and
+    // VEHICLE_SEGMENT_RETENTION_H drops older segments (default 72, 0 keeps
+    // them all).
+    static Options optionsFromEnv() {
+        Options options;
+        if (const char* dir = std::getenv("VEHICLE_DATA_DIR")) {
+            options.dir = dir;
+        }
+        if (const char* flush_ms = std::getenv("VEHICLE_SEGMENT_FLUSH_MS")) {
+            options.flush_interval = std::chrono::milliseconds(std::max(1, std::atoi(flush_ms)));
+        }
+        if (const char* window_s = std::getenv("VEHICLE_SEGMENT_WINDOW_S")) {
+            options.segment_window = std::chrono::seconds(std::max(1, std::atoi(window_s)));
+        }
+        if (const char* max_mb = std::getenv("VEHICLE_SEGMENT_MAX_MB")) {
+            options.segment_max_bytes = static_cast<size_t>(std::max(1, std::atoi(max_mb))) << 20;
+        }
+        if (const char* retention_h = std::getenv("VEHICLE_SEGMENT_RETENTION_H")) {
+            options.retention = std::chrono::hours(std::max(0, std::atoi(retention_h)));
+        }
+        return options;
+    }
+
+    explicit LocationArchive(Options options) : options_(std::move(options)) {}
+
+    ~LocationArchive() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        if (flusher_.joinable()) {
+            flusher_.join();
+        }
+        flush();
+        if (fd_ != -1) {
+            ::close(fd_);
+        }
+    }
+
+    // Maps the sealed segments and seals any log left behind.
+    void recover() {
+        std::filesystem::create_directories(options_.dir);
+
+        std::map<uint64_t, std::filesystem::path> segments;
+        std::map<uint64_t, std::filesystem::path> logs;
+        for (const auto& entry : std::filesystem::directory_iterator(options_.dir)) {
+            uint64_t seq;
+            std::string name = entry.path().filename().string();
+            if (parseName(name, ".seg", seq)) {
+                segments[seq] = entry.path();
+            } else if (parseName(name, ".log", seq)) {
+                logs[seq] = entry.path();
+            }
+        }
+
+        uint64_t points = 0;
+        std::set<uint64_t> replaced_logs;
+        for (const auto& [seq, path] : segments) {
+            replaced_logs.insert(seq);
+            if (auto segment = LocationSegment::open(path.string())) {
+                points += segment->pointCount();
+                sealed_.push_back(segment);
+                for (uint64_t log_seq = seq - std::min<uint64_t>(seq, segment->earlierLogs()); log_seq < seq; ++log_seq) {
+                    replaced_logs.insert(log_seq);
+                }
+            } else {
+                std::cerr << "[LOCATIONS] Ignoring malformed segment " << path << std::endl;
+            }
+        }
+        for (const auto& [seq, path] : logs) {
+            // The segment was written but its logs not yet deleted
+            if (replaced_logs.count(seq)) {
+                std::filesystem::remove(path);
+                continue;
+            }
+            auto columns = std::make_shared<Columns>();
+            points += replayLog(path, *columns);
+            if (columns->empty()) {
+                std::filesystem::remove(path);
+            } else {
+                Sealing sealing{seq, columns};
+                sealing_[seq] = sealing;
+                seal(seq, sealing);
+            }
+        }
+        uint64_t last_seq = std::max(segments.empty() ? 0 : segments.rbegin()->first,
+                                     logs.empty() ? 0 : logs.rbegin()->first);
+        segment_seq_ = last_seq + 1;
+
+        std::cout << "[LOCATIONS] Mapped " << sealed_.size() << " segments with " << points << " points" << std::endl;
+    }
+
+    // Opens a fresh log and starts the background flusher. If the log
+    // cannot be opened, the first flush reports it and keeps retrying.
+    void start() {
+        first_log_seq_ = segment_seq_;
+        openLog(segment_seq_);
+        opened_at_ = std::chrono::steady_clock::now();
+        flusher_ = std::thread([this]() { run(); });
+    }
+
+    // Locks only the vehicle's shard.
+    void append(int32_t vehicle_id, const LocationPoint& point) {
+        Shard& shard = shardFor(vehicle_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.appendLocked(vehicle_id, point);
+    }
+
+    void append(int32_t vehicle_id, const std::vector<LocationPoint>& points) {
+        Shard& shard = shardFor(vehicle_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (const LocationPoint& point : points) {
+            shard.appendLocked(vehicle_id, point);
+        }
+    }
+
+    // The vehicle's points with from_ms <= timestamp <= to_ms, oldest first.
+    std::vector<LocationPoint> range(int32_t vehicle_id, int64_t from_ms, int64_t to_ms) const {
+        std::vector<std::shared_ptr<const LocationSegment>> sealed;
+        std::vector<std::shared_ptr<const Columns>> sealing;
+        std::vector<LocationPoint> points;
+        {
+            // rotate() moves the shards aside under mutex_, so the open
+            // points and the sealing list are read as one consistent view
+            std::lock_guard<std::mutex> lock(mutex_);
+            sealed = sealed_;
+            for (const auto& entry : sealing_) {
+                sealing.push_back(entry.second.columns);
+            }
+            const Shard& shard = shardFor(vehicle_id);
+            std::lock_guard<std::mutex> shard_lock(shard.mutex);
+            collectOpen(shard.open, vehicle_id, from_ms, to_ms, points);
+        }
+        std::vector<LocationPoint> archived;
+        for (const auto& segment : sealed) {
+            segment->collect(vehicle_id, from_ms, to_ms, archived);
+        }
+        for (const auto& columns : sealing) {
+            collectOpen(*columns, vehicle_id, from_ms, to_ms, archived);
+        }
+        archived.insert(archived.end(), points.begin(), points.end());
+
+        // Segments overlap in time only when points arrive late
+        auto by_time = [](const LocationPoint& a, const LocationPoint& b) { return a.timestamp_ms < b.timestamp_ms; };
+        if (!std::is_sorted(archived.begin(), archived.end(), by_time)) {
+            std::stable_sort(archived.begin(), archived.end(), by_time);
+        }
+        return archived;
+    }
+
+private:
+    using Columns = std::unordered_map<int32_t, std::vector<LocationPoint>>;
+
+    // Log record: i32 vehicle_id, i64 timestamp_ms, f64 latitude, f64 longitude.
+    static constexpr size_t kRecordSize = sizeof(int32_t) + sizeof(int64_t) + 2 * sizeof(double);
+
+    static constexpr size_t kShards = 64;
+
+    static constexpr std::chrono::milliseconds kMaxRetryDelay{5000};
+
+    // A segment moved out of the shards, with the first of the logs holding its points
+    struct Sealing {
+        uint64_t first_log;
+        std::shared_ptr<const Columns> columns;
+    };
+
+    // One slice of the open segment: its points and the log records not
+    // yet written. A vehicle always maps to the same shard, so its points
+    // stay in order in both.
+    struct alignas(64) Shard {
+        mutable std::mutex mutex;
+        Columns open;
+        std::string pending;
+        size_t open_points = 0;
+
+        void appendLocked(int32_t vehicle_id, const LocationPoint& point) {
+            open[vehicle_id].push_back(point);
+            ++open_points;
+            char record[kRecordSize];
+            std::memcpy(record, &vehicle_id, sizeof(int32_t));
+            std::memcpy(record + 4, &point.timestamp_ms, sizeof(int64_t));
+            std::memcpy(record + 12, &point.latitude, sizeof(double));
+            std::memcpy(record + 20, &point.longitude, sizeof(double));
+            pending.append(record, kRecordSize);
+        }
+    };
+
+    Shard& shardFor(int32_t vehicle_id) { return shards_[static_cast<uint32_t>(vehicle_id) % kShards]; }
+
+    const Shard& shardFor(int32_t vehicle_id) const { return shards_[static_cast<uint32_t>(vehicle_id) % kShards]; }
+
+    static void collectOpen(const Columns& columns, int32_t vehicle_id, int64_t from_ms, int64_t to_ms,
+                            std::vector<LocationPoint>& out) {
+        auto it = columns.find(vehicle_id);
+        if (it == columns.end()) {
+            return;
+        }
+        for (const LocationPoint& point : it->second) {
+            if (point.timestamp_ms >= from_ms && point.timestamp_ms <= to_ms) {
+                out.push_back(point);
+            }
+        }
+    }
+
+    // Matches locations-<digits><suffix> exactly, so leftover .tmp files are skipped.
+    static bool parseName(const std::string& name, const std::string& suffix, uint64_t& seq) {
+        const std::string prefix = "locations-";
+        if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            return false;
+        }
+        std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        if (digits.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        seq = std::stoull(digits);
+        return true;
+    }
+
+    std::string path(uint64_t seq, const char* suffix) const {
+        char name[64];
+        std::snprintf(name, sizeof(name), "locations-%08" PRIu64 "%s", seq, suffix);
+        return (std::filesystem::path(options_.dir) / name).string();
+    }
+
+    // Frame: u32 record count, u32 checksum, records. Replay stops at the
+    // first torn or corrupt frame. Returns the number of points read.
+    static size_t replayLog(const std::filesystem::path& path, Columns& columns) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return 0;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return 0;
+        }
+        void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            std::cerr << "[LOCATIONS] Failed to map " << path << std::endl;
+            return 0;
+        }
+        ::madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+        const char* pos = static_cast<const char*>(data);
+        const char* end = pos + st.st_size;
+        size_t points = 0;
+        while (static_cast<size_t>(end - pos) >= 2 * sizeof(uint32_t)) {
+            uint32_t count, sum;
+            std::memcpy(&count, pos, sizeof(count));
+            std::memcpy(&sum, pos + 4, sizeof(sum));
+            size_t size = static_cast<size_t>(count) * kRecordSize;
+            if (static_cast<size_t>(end - pos - 8) < size || checksum(pos + 8, size) != sum) {
+                break;
+            }
+            for (const char* record = pos + 8; record < pos + 8 + size; record += kRecordSize) {
+                int32_t vehicle_id;
+                LocationPoint point;
+                std::memcpy(&vehicle_id, record, sizeof(int32_t));
+                std::memcpy(&point.timestamp_ms, record + 4, sizeof(int64_t));
+                std::memcpy(&point.latitude, record + 12, sizeof(double));
+                std::memcpy(&point.longitude, record + 20, sizeof(double));
+                columns[vehicle_id].push_back(point);
+            }
+            points += count;
+            pos += 8 + size;
+        }
+        if (pos < end) {
+            std::cerr << "[LOCATIONS] Stopped replay of " << path << " at a torn frame" << std::endl;
+        }
+        ::munmap(data, st.st_size);
+        return points;
+    }
+
+    // FNV-1a
+    static uint32_t checksum(const char* data, size_t size) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    bool openLog(uint64_t seq) {
+        fd_ = ::open(path(seq, ".log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        struct stat st;
+        if (fd_ != -1 && ::fstat(fd_, &st) == 0) {
+            log_size_ = st.st_size;
+            return true;
+        }
+        if (fd_ != -1) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        return false;
+    }
+
+    // Appends one frame and syncs it. On failure the frame is cut off and
+    // the log closed, so the caller's retry goes to a fresh log: a failed
+    // fdatasync may drop the dirty pages, so syncing this one again proves
+    // nothing. A log that could not be opened is retried under the same
+    // name. Retries back off up to kMaxRetryDelay, and each failure episode
+    // is reported once.
+    bool writeFrame(const std::string& records) {
+        if (records.empty()) {
+            return true;
+        }
+        uint32_t header[2] = {static_cast<uint32_t>(records.size() / kRecordSize),
+                              checksum(records.data(), records.size())};
+        std::string frame(reinterpret_cast<const char*>(header), sizeof(header));
+        frame += records;
+        uint64_t seq = segment_seq_;
+        bool ok = fd_ != -1 || openLog(seq);
+        size_t written = 0;
+        while (ok && written < frame.size()) {
+            ssize_t n = ::write(fd_, frame.data() + written, frame.size() - written);
+            ok = n >= 0;
+            written += ok ? n : 0;
+        }
+        ok = ok && ::fdatasync(fd_) == 0;
+        if (ok) {
+            log_size_ += frame.size();
+            if (retry_delay_.count() > 0) {
+                std::cout << "[LOCATIONS] Log writes recovered in " << path(seq, ".log") << std::endl;
+                retry_delay_ = std::chrono::milliseconds(0);
+            }
+            return true;
+        }
+        if (retry_delay_.count() == 0) {
+            std::cerr << "[LOCATIONS] Failed to write log " << path(seq, ".log") << ", retrying in a new log" << std::endl;
+        }
+        retry_delay_ = std::min(std::max(2 * retry_delay_, options_.flush_interval), kMaxRetryDelay);
+        if (fd_ != -1) {
+            // A frame that did reach the disk would replay twice, once here
+            // and once from the retry; if the cut fails, replay keeps both
+            if (::ftruncate(fd_, log_size_) != 0) {
+                std::cerr << "[LOCATIONS] Failed to cut the failed frame off " << path(seq, ".log") << std::endl;
+            }
+            ::close(fd_);
+            fd_ = -1;
+            ++segment_seq_;
+        }
+        return false;
+    }
+
+    // Writes out everything appended so far and returns the number of
+    // points in the open segment. Records that fail to reach the log wait
+    // in unwritten_, ahead of everything appended later. Only the flusher
+    // thread (or the destructor after it stopped) touches the log file.
+    size_t flush() {
+        std::string batch;
+        batch.swap(unwritten_);
+        size_t open_points = 0;
+        for (Shard& shard : shards_) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            batch += shard.pending;
+            shard.pending.clear();
+            open_points += shard.open_points;
+        }
+        if (!writeFrame(batch)) {
+            unwritten_.swap(batch);
+        }
+        return open_points;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            cv_.wait_for(lock, retry_delay_.count() > 0 ? retry_delay_ : options_.flush_interval,
+                         [this]() { return stopping_; });
+            lock.unlock();
+            size_t open_points = flush();
+            bool seal_due = open_points > 0 &&
+                (open_points * sizeof(LocationPoint) >= options_.segment_max_bytes ||
+                 std::chrono::steady_clock::now() - opened_at_ >= options_.segment_window);
+            if (seal_due) {
+                rotate();
+            }
+            lock.lock();
+        }
+    }
+
+    // Moves the open segment aside, continues in a new log and seals the
+    // old one, along with any earlier segment that failed to seal. Queries
+    // see the points being sealed until the mapping replaces them.
+    void rotate() {
+        std::string batch;
+        batch.swap(unwritten_);
+        auto sealing = std::make_shared<Columns>();
+        uint64_t seq = segment_seq_;
+        std::map<uint64_t, Sealing> pending_seals;
+        {
+            // Ingest waits only while its own shard is moved aside
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (Shard& shard : shards_) {
+                std::lock_guard<std::mutex> shard_lock(shard.mutex);
+                batch += shard.pending;
+                shard.pending.clear();
+                // Shards hold disjoint vehicles, so merging only relinks nodes
+                sealing->merge(shard.open);
+                shard.open.clear();
+                shard.open_points = 0;
+            }
+            sealing_[seq] = Sealing{first_log_seq_, sealing};
+            pending_seals = sealing_;
+        }
+        // Records the log refuses are in the columns, so the seal keeps them
+        writeFrame(batch);
+        if (fd_ != -1) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        segment_seq_ = seq + 1;
+        first_log_seq_ = segment_seq_;
+        openLog(segment_seq_);
+        opened_at_ = std::chrono::steady_clock::now();
+
+        for (const auto& [pending_seq, pending] : pending_seals) {
+            seal(pending_seq, pending);
+        }
+        dropExpired();
+    }
+
+    // Writes the columnar segment for `seq`, maps it, deletes its logs and
+    // drops the columns from sealing_. On failure both stay, so the next
+    // rotation or start tries again.
+    void seal(uint64_t seq, const Sealing& sealing) {
+        std::shared_ptr<const LocationSegment> segment;
+        if (LocationSegment::write(path(seq, ".seg"), *sealing.columns, seq - sealing.first_log)) {
+            segment = LocationSegment::open(path(seq, ".seg"));
+        }
+        if (!segment) {
+            std::cerr << "[LOCATIONS] Failed to seal segment " << path(seq, ".seg") << std::endl;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            sealed_.push_back(segment);
+            sealing_.erase(seq);
+        }
+        for (uint64_t log_seq = sealing.first_log; log_seq <= seq; ++log_seq) {
+            std::remove(path(log_seq, ".log").c_str());
+        }
+        std::cout << "[LOCATIONS] Sealed " << segment->pointCount() << " points into " << segment->path() << std::endl;
+    }
+
+    // Deletes segments whose newest point is older than the retention period.
+    void dropExpired() {
+        if (options_.retention.count() == 0) {
+            return;
+        }
+        int64_t cutoff_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch() - options_.retention).count();
+        std::vector<std::shared_ptr<const LocationSegment>> expired;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto keep = std::stable_partition(sealed_.begin(), sealed_.end(),
+                [cutoff_ms](const auto& segment) { return segment->maxTimestamp() >= cutoff_ms; });
+            expired.assign(keep, sealed_.end());
+            sealed_.erase(keep, sealed_.end());
+        }
+        // Readers still holding a segment keep its mapping alive after the unlink
+        for (const auto& segment : expired) {
+            std::remove(segment->path().c_str());
+        }
+    }
+
+    Options options_;
+
+    std::array<Shard, kShards> shards_;
+
+    // Guards the segment lists and the flusher state; taken before a shard's lock
+    mutable std::mutex mutex_;
+    std::condition_variable cv_;
+    // Segments moved out of the shards and not yet sealed, by sequence number
+    std::map<uint64_t, Sealing> sealing_;
+    std::vector<std::shared_ptr<const LocationSegment>> sealed_;
+    bool stopping_ = false;
+
+    // Log state, flusher thread only
+    int fd_ = -1;
+    // Length of the log up to its last synced frame
+    off_t log_size_ = 0;
+    uint64_t segment_seq_ = 1;
+    // A failed write moves the open segment on to a fresh log, so it may span several
+    uint64_t first_log_seq_ = 1;
+    std::string unwritten_;
+    // Delay before the next attempt after a failed write, zero while the log is healthy
+    std::chrono::milliseconds retry_delay_{0};
+    std::chrono::steady_clock::time_point opened_at_;
+    std::thread flusher_;
+};
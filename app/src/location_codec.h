@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "location_history.h"
+#include "vehicle_service.pb.h"
+
+// Packs one vehicle's points into a LocationBatch. Coordinates are
+// rounded to microdegrees (about 0.1 m) and, like timestamps, sent as
+// zigzag deltas from the previous point, so a vehicle that moves a little
+// between fixes costs a few bytes per point.
+inline void encodeLocations(int32_t vehicle_id, const std::vector<LocationPoint>& points, vehicle::LocationBatch* batch) {
+    batch->Clear();
+    batch->set_vehicle_id(vehicle_id);
+    if (points.empty()) {
+        return;
+    }
+    batch->set_base_timestamp_ms(points.front().timestamp_ms);
+    batch->mutable_timestamp_deltas_ms()->Reserve(points.size());
+    batch->mutable_latitude_deltas()->Reserve(points.size());
+    batch->mutable_longitude_deltas()->Reserve(points.size());
+
+    int64_t timestamp = points.front().timestamp_ms;
+    int32_t latitude = 0;
+    int32_t longitude = 0;
+    for (const LocationPoint& point : points) {
+        int32_t lat = static_cast<int32_t>(std::lround(point.latitude * 1e6));
+        int32_t lon = static_cast<int32_t>(std::lround(point.longitude * 1e6));
+        batch->add_timestamp_deltas_ms(point.timestamp_ms - timestamp);
+        batch->add_latitude_deltas(lat - latitude);
+        batch->add_longitude_deltas(lon - longitude);
+        timestamp = point.timestamp_ms;
+        latitude = lat;
+        longitude = lon;
+    }
+}
+
+// Unpacks a LocationBatch. Returns false if its columns differ in length.
+inline bool decodeLocations(const vehicle::LocationBatch& batch, std::vector<LocationPoint>* points) {
+    const int count = batch.timestamp_deltas_ms_size();
+    if (batch.latitude_deltas_size() != count || batch.longitude_deltas_size() != count) {
+        return false;
+    }
+    points->clear();
+    points->reserve(count);
+    int64_t timestamp = batch.base_timestamp_ms();
+    int64_t latitude = 0;
+    int64_t longitude = 0;
+    for (int i = 0; i < count; ++i) {
+        timestamp += batch.timestamp_deltas_ms(i);
+        latitude += batch.latitude_deltas(i);
+        longitude += batch.longitude_deltas(i);
+        points->push_back(LocationPoint{timestamp, latitude / 1e6, longitude / 1e6});
+    }
+    return true;
+}
@@ -0,0 +1,169 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <initializer_list>
+#include <optional>
+#include <vector>
+
+struct LocationPoint {
+    int64_t timestamp_ms;
+    double latitude;
+    double longitude;
+};
+
+// Fixed-capacity ring of points kept as parallel arrays, oldest first.
+// Appending to a full ring overwrites the oldest point. Not synchronized.
+class LocationRing {
+public:
+    explicit LocationRing(size_t capacity)
+        : timestamps_(capacity), latitudes_(capacity), longitudes_(capacity) {}
+
+    // Returns the overwritten point, if the ring was full.
+    std::optional<LocationPoint> push(const LocationPoint& point) {
+        if (capacity() == 0) {
+            return point;
+        }
+        std::optional<LocationPoint> evicted;
+        size_t slot = (head_ + size_) % capacity();
+        if (size_ == capacity()) {
+            evicted = at(0);
+            head_ = (head_ + 1) % capacity();
+        } else {
+            ++size_;
+        }
+        timestamps_[slot] = point.timestamp_ms;
+        latitudes_[slot] = point.latitude;
+        longitudes_[slot] = point.longitude;
+        return evicted;
+    }
+
+    // i-th oldest point, i < size().
+    LocationPoint at(size_t i) const {
+        size_t slot = (head_ + i) % capacity();
+        return LocationPoint{timestamps_[slot], latitudes_[slot], longitudes_[slot]};
+    }
+
+    size_t size() const { return size_; }
+
+    size_t capacity() const { return timestamps_.size(); }
+
+    // Index of the first point at or after `timestamp_ms`, size() if none.
+    // Points must have been pushed in timestamp order.
+    size_t lowerBound(int64_t timestamp_ms) const {
+        size_t low = 0;
+        size_t high = size_;
+        while (low < high) {
+            size_t mid = low + (high - low) / 2;
+            if (timestamps_[(head_ + mid) % capacity()] < timestamp_ms) {
+                low = mid + 1;
+            } else {
+                high = mid;
+            }
+        }
+        return low;
+    }
+
+private:
+    std::vector<int64_t> timestamps_;
+    std::vector<double> latitudes_;
+    std::vector<double> longitudes_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+};
+
+// Location history of one vehicle with a bounded footprint: the newest
+// points at full resolution, and every downsample-th point pushed out of
+// them in a second, coarser ring. Timestamps are kept non-decreasing, so
+// time ranges are found by binary search. Not synchronized.
+class LocationHistory {
+public:
+    struct Options {
+        size_t capacity = 1024;
+        size_t coarse_capacity = 256;
+        size_t downsample = 8;
+
+        // VEHICLE_HISTORY_CAPACITY, VEHICLE_HISTORY_COARSE_CAPACITY and
+        // VEHICLE_HISTORY_DOWNSAMPLE override the defaults.
+        static Options fromEnv() {
+            Options options;
+            if (const char* value = std::getenv("VEHICLE_HISTORY_CAPACITY")) {
+                options.capacity = std::max(1L, std::atol(value));
+            }
+            if (const char* value = std::getenv("VEHICLE_HISTORY_COARSE_CAPACITY")) {
+                options.coarse_capacity = std::max(0L, std::atol(value));
+            }
+            if (const char* value = std::getenv("VEHICLE_HISTORY_DOWNSAMPLE")) {
+                options.downsample = std::max(1L, std::atol(value));
+            }
+            return options;
+        }
+    };
+
+    explicit LocationHistory(const Options& options)
+        : recent_(options.capacity), coarse_(options.coarse_capacity), downsample_(options.downsample) {}
+
+    // Returns the point as filed.
+    LocationPoint append(LocationPoint point) {
+        // A point stamped before its predecessor is filed at the predecessor's time
+        point.timestamp_ms = std::max(point.timestamp_ms, last_timestamp_ms_);
+        last_timestamp_ms_ = point.timestamp_ms;
+        auto evicted = recent_.push(point);
+        if (evicted && evicted_++ % downsample_ == 0) {
+            coarse_.push(*evicted);
+        }
+        return point;
+    }
+
+    std::optional<LocationPoint> latest() const {
+        if (recent_.size() == 0) {
+            return std::nullopt;
+        }
+        return recent_.at(recent_.size() - 1);
+    }
+
+    size_t size() const { return coarse_.size() + recent_.size(); }
+
+    // Visits every kept point, oldest first.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (size_t i = 0; i < coarse_.size(); ++i) {
+            fn(coarse_.at(i));
+        }
+        for (size_t i = 0; i < recent_.size(); ++i) {
+            fn(recent_.at(i));
+        }
+    }
+
+    // Points with from_ms <= timestamp <= to_ms, oldest first.
+    std::vector<LocationPoint> range(int64_t from_ms, int64_t to_ms) const {
+        std::vector<LocationPoint> points;
+        for (const LocationRing* ring : {&coarse_, &recent_}) {
+            size_t begin = ring->lowerBound(from_ms);
+            size_t end = to_ms == INT64_MAX ? ring->size() : ring->lowerBound(to_ms + 1);
+            for (size_t i = begin; i < end; ++i) {
+                points.push_back(ring->at(i));
+            }
+        }
+        return points;
+    }
+
+    // Up to `count` newest full-resolution points, oldest first.
+    std::vector<LocationPoint> recent(size_t count) const {
+        count = std::min(count, recent_.size());
+        std::vector<LocationPoint> points;
+        points.reserve(count);
+        for (size_t i = recent_.size() - count; i < recent_.size(); ++i) {
+            points.push_back(recent_.at(i));
+        }
+        return points;
+    }
+
+private:
+    LocationRing recent_;
+    LocationRing coarse_;
+    size_t downsample_;
+    uint64_t evicted_ = 0;
+    int64_t last_timestamp_ms_ = INT64_MIN;
+};
@@ -2,10 +2,14 @@
 #include <thread>
 #include <chrono>
 #include <random>
+#include <string>
+#include <cstdlib>
+#include <map>
 
 #include <grpcpp/grpcpp.h>
 #include <grpc/grpc.h>
 #include "vehicle_service.grpc.pb.h"
+#include "telemetry.h"
 
 using grpc::Channel;
 using grpc::ClientContext;
@@ -17,9 +21,20 @@ using namespace vehicle;
 class ManagerClient {
 public:
     ManagerClient(std::shared_ptr<grpc::ChannelInterface> channel, int num_vehicles)
-    : stub_(VehicleService::NewStub(channel)), rng_(std::random_device{}()), max_vehicle_id_(num_vehicles) {}
+    : stub_(VehicleService::NewStub(channel)), rng_(std::random_device{}()), max_vehicle_id_(num_vehicles) {
+        // MANAGER_FLEET_COUNTS=1 asks for every vehicle's count in one call instead of one vehicle per call
+        const char* fleet_env = std::getenv("MANAGER_FLEET_COUNTS");
+        fleet_counts_ = fleet_env && std::string(fleet_env) == "1";
+        // MANAGER_FLEET_WATCH=1 follows the whole fleet on one watchFleet stream instead of tracking single vehicles
+        const char* watch_env = std::getenv("MANAGER_FLEET_WATCH");
+        fleet_watch_ = watch_env && std::string(watch_env) == "1";
+    }
 
     void Run() {
+        if (fleet_watch_) {
+            WatchFleet();
+            return;
+        }
 
         std::uniform_int_distribution<int> vehicle_dist(0, max_vehicle_id_);
         std::uniform_int_distribution<int> sleep_dist(3000, 6000);
@@ -31,8 +46,11 @@ public:
 
             TrackRequest req;
             req.set_vehicle_id(vehicle_id);
+            req.set_max_updates(10);
 
+            // Live tracking only ends on max_updates, so bound it in time too
             ClientContext context;
+            context.set_deadline(std::chrono::system_clock::now() + std::chrono::seconds(30));
             auto reader = stub_->trackVehicle(&context, req);
 
             Location loc;
@@ -42,12 +60,18 @@ public:
             }
 
             Status status = reader->Finish();
-            if (!status.ok()) {
+            if (!status.ok() && status.error_code() != grpc::StatusCode::DEADLINE_EXCEEDED) {
                 std::cerr << "[!] trackVehicle failed: " << status.error_message() << std::endl;
             }
             std::this_thread::sleep_for(std::chrono::milliseconds(sleep_dist(rng_)));
 
 
+            if (fleet_counts_) {
+                ReportFleet();
+                std::this_thread::sleep_for(std::chrono::milliseconds(sleep_dist(rng_)));
+                continue;
+            }
+
             //getPackagesDeliveredBy
             vehicle_id = vehicle_dist(rng_);
             DeliveryQuery dq;
@@ -68,9 +92,67 @@ public:
     }
 
 private:
+    // Keeps the fleet view from watchFleet frames and prints it: every
+    // vehicle on a snapshot, then the vehicles that moved on each delta.
+    // Reconnects when the stream ends.
+    void WatchFleet() {
+        std::uniform_int_distribution<int> retry_dist(1000, 3000);
+        std::map<int32_t, Location> fleet;
+
+        while (true) {
+            FleetWatchRequest req;
+            ClientContext context;
+            auto reader = stub_->watchFleet(&context, req);
+
+            FleetFrame frame;
+            while (reader->Read(&frame)) {
+                if (frame.snapshot()) {
+                    fleet.clear();
+                }
+                for (const auto& loc : frame.vehicles()) {
+                    fleet[loc.vehicle_id()] = loc;
+                    std::cout << "[FLEET] Vehicle " << loc.vehicle_id()
+                    << " Location: (" << loc.latitude() << ", " << loc.longitude() << ")\n";
+                }
+                std::cout << "[FLEET] Tick " << frame.tick() << ": " << fleet.size() << " vehicles, "
+                << frame.vehicles_size() << (frame.snapshot() ? " in snapshot" : " moved") << std::endl;
+            }
+
+            Status status = reader->Finish();
+            if (!status.ok()) {
+                std::cerr << "[!] watchFleet failed: " << status.error_message() << std::endl;
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(retry_dist(rng_)));
+        }
+    }
+
+    // Delivered counts of the whole fleet from one getPackagesDeliveredByFleet call
+    void ReportFleet() {
+        FleetDeliveryQuery query;
+        query.set_all(true);
+
+        ClientContext context;
+        FleetDeliveryCounts counts;
+        Status status = stub_->getPackagesDeliveredByFleet(&context, query, &counts);
+        if (!status.ok()) {
+            std::cerr << "[!] getPackagesDeliveredByFleet failed: " << status.error_message() << std::endl;
+            return;
+        }
+        int total = 0;
+        for (const auto& entry : counts.counts()) {
+            std::cout << "[DELIVERY COUNT] Vehicle " << entry.vehicle_id()
+            << " delivered " << entry.count() << " packages today\n";
+            total += entry.count();
+        }
+        // The reply lists only vehicles that delivered something, not the whole fleet
+        std::cout << "[DELIVERY COUNT] " << counts.counts_size() << " vehicles delivered " << total << " packages today\n";
+    }
+
     std::unique_ptr<VehicleService::Stub> stub_;
     std::default_random_engine rng_;
     int max_vehicle_id_;
+    bool fleet_counts_ = false;
+    bool fleet_watch_ = false;
 };
 
 int main(int argc, char** argv) {
@@ -85,10 +167,12 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    initTelemetry(TelemetryOptions::fromEnv("manager-client"));
     std::string server_addr = "vehicle-service:50052";
     auto channel = grpc::CreateChannel(server_addr, grpc::InsecureChannelCredentials());
     ManagerClient client(channel, num_vehicles-1);
     client.Run();
+    shutdownTelemetry();
 
     return 0;
 }
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+
+#include "opentelemetry/common/key_value_iterable.h"
+#include "telemetry.h"
+
+// The {vehicle_id} attribute set of one vehicle, built once and passed
+// to Counter::Add by reference. This saves building a map and a string
+// per update on our side; the SDK still copies the attributes into its
+// own map when it records the measurement.
+class VehicleAttributes final : public opentelemetry::common::KeyValueIterable {
+public:
+    explicit VehicleAttributes(std::string vehicle_id) : vehicle_id_(std::move(vehicle_id)) {}
+
+    bool ForEachKeyValue(opentelemetry::nostd::function_ref<bool(opentelemetry::nostd::string_view,
+                                                                 opentelemetry::common::AttributeValue)>
+                             callback) const noexcept override {
+        return callback(kVehicleIdAttribute, opentelemetry::nostd::string_view(vehicle_id_));
+    }
+
+    size_t size() const noexcept override { return 1; }
+
+private:
+    std::string vehicle_id_;
+};
+
+// Attribute sets for vehicle_id-labelled instruments, cached per vehicle
+// in lock-striped shards. Only the first `limit` vehicles get their own
+// label; later ones share vehicle_id="other", which bounds the series
+// kept by the SDK and the collector however large the fleet grows.
+// Labels are handed out by of(), which ingest paths call for vehicles
+// that actually report; query RPCs use find() so arbitrary requested ids
+// cannot use up the limit.
+class VehicleLabels {
+public:
+    static constexpr size_t kShards = 16;
+
+    explicit VehicleLabels(size_t limit) : limit_(limit), other_("other") {}
+
+    // METRIC_VEHICLE_LABEL_LIMIT overrides the default of 1000 vehicles.
+    static size_t limitFromEnv() {
+        const char* value = std::getenv("METRIC_VEHICLE_LABEL_LIMIT");
+        return value ? std::max(0L, std::atol(value)) : 1000;
+    }
+
+    // The vehicle's label, or "other" if it has none. Never assigns one.
+    const VehicleAttributes& find(int32_t vehicle_id) {
+        Shard& shard = shards_[static_cast<uint32_t>(vehicle_id) % kShards];
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.labels.find(vehicle_id);
+        return it != shard.labels.end() ? *it->second : other_;
+    }
+
+    // The returned reference stays valid for the lifetime of the cache.
+    const VehicleAttributes& of(int32_t vehicle_id) {
+        Shard& shard = shards_[static_cast<uint32_t>(vehicle_id) % kShards];
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.labels.find(vehicle_id);
+            if (it != shard.labels.end()) {
+                return *it->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.labels.find(vehicle_id);
+        if (it != shard.labels.end()) {
+            return *it->second;
+        }
+        if (labelled_.fetch_add(1, std::memory_order_relaxed) >= limit_) {
+            labelled_.fetch_sub(1, std::memory_order_relaxed);
+            return other_;
+        }
+        auto& labels = shard.labels[vehicle_id];
+        labels = std::make_unique<VehicleAttributes>(std::to_string(vehicle_id));
+        return *labels;
+    }
+
+private:
+    struct Shard {
+        std::shared_mutex mutex;
+        std::unordered_map<int32_t, std::unique_ptr<VehicleAttributes>> labels;
+    };
+
+    size_t limit_;
+    std::atomic<size_t> labelled_{0};
+    VehicleAttributes other_;
+    std::array<Shard, kShards> shards_;
+};
@@ -3,28 +3,17 @@
 #include <string>
 #include <vector>
 #include <mutex>
-#include <condition_variable>
+#include <optional>
+#include <deque>
+#include <unordered_set>
 #include <thread>
 #include <chrono>
 #include <cstdlib>
 
-#include <opentelemetry/exporters/otlp/otlp_grpc_exporter.h>
-#include <opentelemetry/sdk/trace/simple_processor.h>
-#include <opentelemetry/sdk/trace/tracer_provider.h>
-#include <opentelemetry/trace/provider.h>
-#include <opentelemetry/sdk/resource/resource.h>
-
-#include <opentelemetry/exporters/otlp/otlp_grpc_log_record_exporter_factory.h>
-#include <opentelemetry/exporters/otlp/otlp_grpc_log_record_exporter_options.h>
 #include <opentelemetry/logs/provider.h>
-#include <opentelemetry/sdk/logs/logger_provider_factory.h>
-#include <opentelemetry/sdk/logs/simple_log_record_processor_factory.h>
-
-#include <opentelemetry/exporters/otlp/otlp_grpc_metric_exporter_factory.h>
-#include <opentelemetry/sdk/metrics/meter_provider_factory.h>
-#include <opentelemetry/sdk/metrics/export/periodic_exporting_metric_reader_factory.h>
-#include <opentelemetry/sdk/metrics/meter_context_factory.h>
 #include <opentelemetry/metrics/provider.h>
+#include <opentelemetry/metrics/sync_instruments.h>
+#include <opentelemetry/trace/provider.h>
 
 #include <grpc/grpc.h>
 #include <grpcpp/server.h>
@@ -32,120 +21,431 @@
 #include <grpcpp/security/server_credentials.h>
 #include "package_service.grpc.pb.h"
 #include "vehicle_service.grpc.pb.h"
+#include "package_store.h"
+#include "delay_scheduler.h"
+#include "package_wal.h"
+#include "package_watch.h"
+#include "latency_injection.h"
+#include "telemetry.h"
+#include "async_log.h"
+#include "metric_labels.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
 using grpc::ServerContext;
-using grpc::ServerReaderWriter;
 using grpc::ServerWriter;
 using grpc::Status;
 
 using packages::PackageService;
 using packages::PackageData;
 using packages::PackageResponse;
+using packages::PackageBatch;
+using packages::PackageBatchResponse;
 using packages::PackageStatusRequest;
 using packages::PackageStatusResponse;
 using packages::PackageUpdate;
 using packages::PackageInstruction;
 using packages::PackageStatus;
+using packages::PackageWatchRequest;
+using packages::PackageStatusEvent;
 using packages::VehicleQuery;
 using packages::DeliveredCount;
+using packages::VehicleBatchQuery;
+using packages::DeliveredCounts;
 
-namespace trace_sdk = opentelemetry::sdk::trace;
 namespace trace_api = opentelemetry::trace;
-namespace otlp_exporter = opentelemetry::exporter::otlp;
-namespace metrics_sdk = opentelemetry::sdk::metrics;
 namespace metrics_api = opentelemetry::metrics;
-namespace resource = opentelemetry::sdk::resource;
 namespace logs_api = opentelemetry::logs;
-namespace logs_sdk = opentelemetry::sdk::logs;
-
-void initTelemetry() {
-    // Resource attributes
-    auto resource_attributes = resource::Resource::Create({
-        {"service.name", "package-service"},
-        {"service.version", "1.0.0"},
-        {"deployment.environment", "dev"}
-    });
-
-    // Tracing
-    otlp_exporter::OtlpGrpcExporterOptions trace_opts;
-    trace_opts.endpoint = "simplest-collector:4317";
-    trace_opts.use_ssl_credentials = false;
-    auto trace_exporter = std::unique_ptr<trace_sdk::SpanExporter>(
-        new otlp_exporter::OtlpGrpcExporter(trace_opts));
-    auto trace_processor = std::unique_ptr<trace_sdk::SpanProcessor>(
-        new trace_sdk::SimpleSpanProcessor(std::move(trace_exporter)));
-    auto trace_provider = std::shared_ptr<trace_api::TracerProvider>(
-        new trace_sdk::TracerProvider(std::move(trace_processor), resource_attributes));
-    trace_api::Provider::SetTracerProvider(trace_provider);
-
-    // Logging
-    otlp_exporter::OtlpGrpcLogRecordExporterOptions log_opts;
-    log_opts.endpoint = "simplest-collector:4317";
-    log_opts.use_ssl_credentials = false;
-    auto log_exporter = otlp_exporter::OtlpGrpcLogRecordExporterFactory::Create(log_opts);
-    auto log_processor = logs_sdk::SimpleLogRecordProcessorFactory::Create(std::move(log_exporter));
-    std::shared_ptr<logs_api::LoggerProvider> log_provider =
-        logs_sdk::LoggerProviderFactory::Create(std::move(log_processor), resource_attributes);
-    logs_api::Provider::SetLoggerProvider(log_provider);
-
-    // Metrics
-    otlp_exporter::OtlpGrpcMetricExporterOptions metric_opts;
-    metric_opts.endpoint = "simplest-collector:4317";
-    metric_opts.use_ssl_credentials = false;
-    auto metric_exporter = otlp_exporter::OtlpGrpcMetricExporterFactory::Create(metric_opts);
-
-    metrics_sdk::PeriodicExportingMetricReaderOptions reader_options;
-    reader_options.export_interval_millis = std::chrono::milliseconds(1000);
-    reader_options.export_timeout_millis  = std::chrono::milliseconds(500);
-
-    auto reader = metrics_sdk::PeriodicExportingMetricReaderFactory::Create(std::move(metric_exporter), reader_options);
-    auto context = metrics_sdk::MeterContextFactory::Create();
-    context->AddMetricReader(std::move(reader));
-
-    auto u_provider = metrics_sdk::MeterProviderFactory::Create(std::move(context));
-    std::shared_ptr<metrics_api::MeterProvider> provider(std::move(u_provider));
-    metrics_api::Provider::SetMeterProvider(provider);
-}
 
-struct Package {
-    int package_id;
-    int delivered_by;
-    std::string sender_address;
-    std::string recipient_address;
-    PackageStatus status;
-};
-
-class PackageServiceImpl final : public PackageService::Service {
+class PackageServiceImpl final
+    : public PackageService::WithCallbackMethod_createPackage<
+          PackageService::WithCallbackMethod_createPackages<
+          PackageService::WithCallbackMethod_updatePackages<
+          PackageService::WithCallbackMethod_watchPackages<PackageService::Service>>>> {
 private:
-    std::vector<Package> packages_;
-    int next_id_ = 1;
-    std::mutex mutex_;
-    std::condition_variable package_available_cv_;
+    static constexpr int32_t kMaxBatchSize = 10000;
+
+    PackageStore store_;
+    ReadyQueue ready_queue_;
+    DelayScheduler delays_;
+    PackageWatchHub watch_hub_;
+
+    LatencyPolicy read_update_latency_ = LatencyPolicy::fromEnv("UPDATE_PACKAGES_READ", LatencyPolicy::uniform(80, 200));
+    LatencyPolicy assign_package_latency_ = LatencyPolicy::fromEnv("UPDATE_PACKAGES_ASSIGN", LatencyPolicy::uniform(60, 160));
+    LatencyPolicy write_instruction_latency_ = LatencyPolicy::fromEnv("UPDATE_PACKAGES_WRITE", LatencyPolicy::uniform(70, 170));
+    std::unique_ptr<PackageWal> wal_;
+
+    // Acknowledges a create once it is in the log. With persistence the
+    // reactor finishes from the WAL's group commit; no thread waits.
+    grpc::ServerUnaryReactor* finishWhenDurable(grpc::ServerUnaryReactor* reactor) {
+        if (!wal_) {
+            reactor->Finish(Status::OK);
+            return reactor;
+        }
+        wal_->whenDurable([reactor](bool ok) {
+            reactor->Finish(ok ? Status::OK : Status(grpc::StatusCode::INTERNAL, "Package could not be persisted"));
+        });
+        return reactor;
+    }
+
+    // Puts a CREATED package back in line for assignment.
+    void requeue(int32_t package_id) {
+        if (auto pkg = store_.find(package_id)) {
+            ready_queue_.push(ReadyPackage{package_id, pkg->destination});
+        }
+    }
     opentelemetry::nostd::shared_ptr<trace_api::Tracer> tracer_;
-    opentelemetry::nostd::shared_ptr<logs_api::Logger> logger_;
     opentelemetry::nostd::shared_ptr<metrics_api::Meter> meter_;
     opentelemetry::nostd::shared_ptr<metrics_api::Counter<uint64_t>> created_packages_counter_;
     opentelemetry::nostd::shared_ptr<metrics_api::Counter<uint64_t>> get_package_status_counter_;
     opentelemetry::nostd::shared_ptr<metrics_api::Counter<uint64_t>> update_packages_requests_counter_;
     opentelemetry::nostd::shared_ptr<metrics_api::Counter<double>> delivered_packages_counter_;
     opentelemetry::nostd::shared_ptr<metrics_api::Histogram<double>> create_package_duration_histogram_;
+    opentelemetry::nostd::shared_ptr<metrics_api::Histogram<double>> create_packages_duration_histogram_;
     opentelemetry::nostd::shared_ptr<metrics_api::Counter<uint64_t>> not_found_package_status_counter_;
+    opentelemetry::nostd::shared_ptr<metrics_api::Counter<uint64_t>> watch_packages_requests_counter_;
+    opentelemetry::nostd::shared_ptr<metrics_api::Counter<uint64_t>> package_status_events_counter_;
+    VehicleLabels vehicle_labels_{VehicleLabels::limitFromEnv()};
+
+    // Serves one vehicle's updatePackages stream. Each step (read update,
+    // record delivery, wait for a package, write instruction) runs as a
+    // reaction, so a vehicle waiting for work does not hold a thread.
+    class UpdatePackagesReactor : public grpc::ServerBidiReactor<PackageUpdate, PackageInstruction> {
+    public:
+        explicit UpdatePackagesReactor(PackageServiceImpl* service)
+            : service_(service), span_(service->tracer_->StartSpan("update_packages")) {
+            auto ctx = span_->GetContext();
+            LOG_SPAN_INFO(ctx, "[SERVER] updatePackages called");
+            StartRead(&update_);
+        }
+
+        void OnReadDone(bool ok) override {
+            if (!ok) {
+                Finish(Status::OK);
+                return;
+            }
+            // The archive marks free slots with this id, so it cannot deliver
+            if (update_.package_id() != -1 && update_.status() == PackageStatus::DELIVERED &&
+                update_.vehicle_id() == DeliveredArchive::kEmpty) {
+                Finish(Status(grpc::INVALID_ARGUMENT, "Vehicle id " + std::to_string(update_.vehicle_id()) + " is reserved"));
+                return;
+            }
+            after(service_->read_update_latency_, [this]() {
+                handleDelivery();
+                after(service_->assign_package_latency_, [this]() { requestPackage(); });
+            });
+        }
+
+        void OnWriteDone(bool ok) override {
+            if (!ok) {
+                releasePackage();
+                Finish(Status::CANCELLED);
+                return;
+            }
+            package_id_ = -1;
+            StartRead(&update_);
+        }
+
+        void OnCancel() override {
+            std::unique_lock<std::mutex> lock(mutex_);
+            cancelled_ = true;
+            if (waiting_ && service_->ready_queue_.cancel(ticket_)) {
+                waiting_ = false;
+                lock.unlock();
+                Finish(Status::CANCELLED);
+            }
+        }
+
+        void OnDone() override {
+            span_->End();
+            delete this;
+        }
+
+    private:
+        // Runs `next` after the policy's delay on the shared scheduler, or
+        // finishes the call if it got cancelled or drew an injected failure.
+        void after(const LatencyPolicy& policy, std::function<void()> next) {
+            auto run = [this, &policy, next = std::move(next)]() {
+                if (isCancelled()) {
+                    releasePackage();
+                    Finish(Status::CANCELLED);
+                    return;
+                }
+                if (policy.shouldFail()) {
+                    releasePackage();
+                    Finish(Status(grpc::StatusCode::UNAVAILABLE, "Injected failure"));
+                    return;
+                }
+                next();
+            };
+            auto delay = policy.draw();
+            if (delay.count() == 0) {
+                run();
+                return;
+            }
+            service_->delays_.schedule(delay, std::move(run));
+        }
+
+        void handleDelivery() {
+            if (update_.package_id() == -1 || update_.status() != PackageStatus::DELIVERED ||
+                !service_->store_.markDelivered(update_.package_id(), update_.vehicle_id())) {
+                return;
+            }
+            service_->watch_hub_.deliver();
+            service_->delivered_packages_counter_->Add(1.0, service_->vehicle_labels_.of(update_.vehicle_id()));
+
+            LOG_DEBUG("[SERVER] Package " << update_.package_id() << " delivered by vehicle "
+            << update_.vehicle_id());
+
+            if (span_->IsRecording()) {
+                span_->AddEvent("Package " + std::to_string(update_.package_id()) + " delivered by vehicle " + std::to_string(update_.vehicle_id()));
+            }
+        }
+
+        // 🔁 Take the nearest (or oldest) CREATED package, or queue up until one is handed over
+        void requestPackage() {
+            std::optional<GeoPoint> position;
+            if (update_.has_position()) {
+                position = GeoPoint{update_.position().latitude(), update_.position().longitude()};
+            }
+            std::unique_lock<std::mutex> lock(mutex_);
+            // OnCancel may have run since after() checked; it found nothing to
+            // cancel then, so a waiter queued now would outlive the call
+            if (cancelled_) {
+                lock.unlock();
+                Finish(Status::CANCELLED);
+                return;
+            }
+            int32_t package_id = service_->ready_queue_.popOrWait(
+                position, [this](int32_t id) { onPackage(id); }, &ticket_);
+            if (package_id == -1) {
+                waiting_ = true;
+                return;
+            }
+            lock.unlock();
+            onPackage(package_id);
+        }
+
+        void onPackage(int32_t package_id) {
+            bool cancelled;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                waiting_ = false;
+                cancelled = cancelled_;
+            }
+            if (cancelled) {
+                // Lost the race with OnCancel, give the package to the next vehicle
+                service_->requeue(package_id);
+                Finish(Status::CANCELLED);
+                return;
+            }
+            if (!service_->store_.transition(package_id, PackageStatus::CREATED, PackageStatus::IN_TRANSIT)) {
+                requestPackage();
+                return;
+            }
+            service_->watch_hub_.deliver();
+            package_id_ = package_id;
+            auto pkg = service_->store_.find(package_id);
+
+            instr_.set_package_id(pkg->package_id);
+            instr_.set_delivery_address(pkg->recipient_address);
+            if (pkg->destination) {
+                instr_.mutable_destination()->set_latitude(pkg->destination->latitude);
+                instr_.mutable_destination()->set_longitude(pkg->destination->longitude);
+            } else {
+                instr_.clear_destination();
+            }
+
+            LOG_DEBUG("[SERVER] Assigned package " << pkg->package_id << " to vehicle "
+            << update_.vehicle_id());
+
+            if (span_->IsRecording()) {
+                span_->AddEvent("Assigned package " + std::to_string(pkg->package_id) + " to vehicle " + std::to_string(update_.vehicle_id()));
+            }
+
+            after(service_->write_instruction_latency_, [this]() { StartWrite(&instr_); });
+        }
+
+        // Puts an assigned but undelivered instruction back up for grabs.
+        void releasePackage() {
+            if (package_id_ != -1 &&
+                service_->store_.transition(package_id_, PackageStatus::IN_TRANSIT, PackageStatus::CREATED)) {
+                service_->watch_hub_.deliver();
+                service_->requeue(package_id_);
+            }
+            package_id_ = -1;
+        }
+
+        bool isCancelled() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return cancelled_;
+        }
+
+        PackageServiceImpl* service_;
+        opentelemetry::nostd::shared_ptr<trace_api::Span> span_;
+        PackageUpdate update_;
+        PackageInstruction instr_;
+        int32_t package_id_ = -1;
+
+        std::mutex mutex_;
+        bool cancelled_ = false;
+        bool waiting_ = false;
+        uint64_t ticket_ = 0;
+    };
+
+    // Serves one watchPackages stream. Sends the current status of every
+    // known package, then each change as the store applies it, and finishes
+    // once all of them are delivered. Unknown ids are skipped.
+    class WatchPackagesReactor : public grpc::ServerWriteReactor<PackageStatusEvent>, public PackageWatcher {
+    public:
+        WatchPackagesReactor(PackageServiceImpl* service, const PackageWatchRequest& request)
+            : service_(service), span_(service->tracer_->StartSpan("watch_packages")) {
+            span_->SetAttribute("package_count", request.package_ids_size());
+            if (request.package_ids_size() > kMaxBatchSize) {
+                finished_ = true;
+                Finish(Status(grpc::INVALID_ARGUMENT, "Cannot watch more than " + std::to_string(kMaxBatchSize) + " packages"));
+                return;
+            }
+            for (int32_t package_id : request.package_ids()) {
+                if (open_.insert(package_id).second) {
+                    package_ids_.push_back(package_id);
+                }
+            }
+            // Subscribe before reading the current status, so no change falls in between
+            for (int32_t package_id : package_ids_) {
+                service_->watch_hub_.subscribe(package_id, this);
+            }
+            for (int32_t package_id : package_ids_) {
+                auto pkg = service_->store_.find(package_id);
+                std::lock_guard<std::mutex> lock(mutex_);
+                if (changed_.count(package_id)) {
+                    continue;
+                }
+                if (!pkg) {
+                    open_.erase(package_id);
+                    continue;
+                }
+                enqueueLocked(*pkg);
+            }
+            pump();
+        }
+
+        void onPackageChanged(const Package& pkg) override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            changed_.insert(pkg.package_id);
+            enqueueLocked(pkg);
+        }
+
+        void onChangesQueued() override { pump(); }
+
+        void OnWriteDone(bool ok) override {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                writing_ = false;
+                if (!ok) {
+                    finishLocked();
+                    return;
+                }
+            }
+            pump();
+        }
+
+        void OnCancel() override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finishLocked();
+        }
+
+        void OnDone() override {
+            for (int32_t package_id : package_ids_) {
+                service_->watch_hub_.unsubscribe(package_id, this);
+            }
+            waitForDeliveries();
+            // Wait out a pump() that is still returning from Finish
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+            }
+            span_->End();
+            delete this;
+        }
+
+    private:
+        void enqueueLocked(const Package& pkg) {
+            PackageStatusEvent event;
+            event.set_package_id(pkg.package_id);
+            event.set_status(pkg.status);
+            event.set_delivered_by(pkg.delivered_by);
+            pending_.push_back(std::move(event));
+            if (pkg.status == PackageStatus::DELIVERED) {
+                open_.erase(pkg.package_id);
+            }
+        }
+
+        // Starts the next write, or finishes once nothing is left to report.
+        // gRPC allows one outstanding write, so events queue up behind it.
+        void pump() {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (finished_ || writing_) {
+                return;
+            }
+            if (!pending_.empty()) {
+                event_ = std::move(pending_.front());
+                pending_.pop_front();
+                writing_ = true;
+                service_->package_status_events_counter_->Add(1);
+                StartWrite(&event_);
+            } else if (open_.empty()) {
+                finished_ = true;
+                Finish(Status::OK);
+            }
+        }
+
+        void finishLocked() {
+            if (!finished_) {
+                finished_ = true;
+                Finish(Status::CANCELLED);
+            }
+        }
+
+        PackageServiceImpl* service_;
+        opentelemetry::nostd::shared_ptr<trace_api::Span> span_;
+        std::vector<int32_t> package_ids_;
+
+        std::mutex mutex_;
+        std::unordered_set<int32_t> open_;
+        std::unordered_set<int32_t> changed_;
+        std::deque<PackageStatusEvent> pending_;
+        PackageStatusEvent event_;
+        bool writing_ = false;
+        bool finished_ = false;
+    };
 
 public:
     PackageServiceImpl() {
         tracer_ = trace_api::Provider::GetTracerProvider()->GetTracer("package-service");
-        logger_ = logs_api::Provider::GetLoggerProvider()->GetLogger("package-service");
         meter_ = metrics_api::Provider::GetMeterProvider()->GetMeter("package-service");
         created_packages_counter_ = meter_->CreateUInt64Counter("created_packages_total");
         get_package_status_counter_ = meter_->CreateUInt64Counter("get_package_status_requests_total");
         update_packages_requests_counter_ = meter_->CreateUInt64Counter("update_packages_requests_total");
         delivered_packages_counter_ = meter_->CreateDoubleCounter("delivered_packages_total");
         create_package_duration_histogram_ = meter_->CreateDoubleHistogram("create_package_duration_seconds");
+        create_packages_duration_histogram_ = meter_->CreateDoubleHistogram("create_packages_duration_seconds");
         not_found_package_status_counter_ = meter_->CreateUInt64Counter("not_found_package_status_total");
+        watch_packages_requests_counter_ = meter_->CreateUInt64Counter("watch_packages_requests_total");
+        package_status_events_counter_ = meter_->CreateUInt64Counter("package_status_events_total");
+
+        store_.addObserver(&watch_hub_);
     }
-    Status createPackage(ServerContext* context,
+
+    // Restores packages from the data directory and logs every later change
+    // to it. Must run before the server starts.
+    void enablePersistence(PackageWal::Options options) {
+        wal_ = std::make_unique<PackageWal>(std::move(options), store_);
+        ready_queue_.pushAll(wal_->recover());
+        store_.addObserver(wal_.get());
+        wal_->start();
+    }
+
+    grpc::ServerUnaryReactor* createPackage(grpc::CallbackServerContext* context,
                      const PackageData* request,
                      PackageResponse* response) override {
 
@@ -155,182 +455,160 @@ public:
     span->SetAttribute("recipient", request->recipient_address());
     auto ctx = span->GetContext();
 
-    std::lock_guard<std::mutex> lock(mutex_);
-
-    Package pkg;
-    pkg.package_id = next_id_++;
-    pkg.sender_address = request->sender_address();
-    pkg.recipient_address = request->recipient_address();
-    pkg.status = PackageStatus::CREATED;
-    pkg.delivered_by = -1;
-
-    packages_.push_back(pkg);
+    Package pkg = store_.create(*request);
 
     response->set_package_id(pkg.package_id);
-    std::cout << "Created package ID: " << pkg.package_id << std::endl;
 
     created_packages_counter_->Add(1);
 
-    logger_->EmitLogRecord(
-        logs_api::Severity::kInfo,
-        "New package created: sender=" + pkg.sender_address + ", recipient=" + pkg.recipient_address,
-        ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),
-        opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now())
-    );
+    LOG_SPAN_INFO(ctx, "[SERVER] Created package ID " << pkg.package_id << ": sender=" << pkg.sender_address
+            << ", recipient=" << pkg.recipient_address);
 
-    span->AddEvent("Package created with ID " + std::to_string(pkg.package_id));
-    span->AddEvent("Sender address: " + pkg.sender_address);
-    span->AddEvent("Recipient address: " + pkg.recipient_address);
+    if (span->IsRecording()) {
+        span->AddEvent("Package created with ID " + std::to_string(pkg.package_id));
+        span->AddEvent("Sender address: " + pkg.sender_address);
+        span->AddEvent("Recipient address: " + pkg.recipient_address);
+    }
     span->End();
 
-    package_available_cv_.notify_one();
+    ready_queue_.push(ReadyPackage{pkg.package_id, pkg.destination});
+
     auto end = std::chrono::steady_clock::now();
     std::chrono::duration<double> elapsed = end - start;
     create_package_duration_histogram_->Record(elapsed.count(), opentelemetry::context::Context{});
 
-    return Status::OK;
+    return finishWhenDurable(context->DefaultReactor());
 }
 
+    grpc::ServerUnaryReactor* createPackages(grpc::CallbackServerContext* context,
+                                             const PackageBatch* request,
+                                             PackageBatchResponse* response) override {
+        auto* reactor = context->DefaultReactor();
+        auto start = std::chrono::steady_clock::now();
+        const int32_t count = request->packages_size();
+        if (count == 0) {
+            reactor->Finish(Status::OK);
+            return reactor;
+        }
+        if (count > kMaxBatchSize) {
+            reactor->Finish(Status(grpc::INVALID_ARGUMENT, "Batch larger than " + std::to_string(kMaxBatchSize) + " packages"));
+            return reactor;
+        }
+
+        auto span = tracer_->StartSpan("create_packages");
+        span->SetAttribute("batch_size", count);
+        auto ctx = span->GetContext();
+
+        int32_t first_id = store_.createBatch(request->packages());
+        response->mutable_package_ids()->Reserve(count);
+        for (int32_t i = 0; i < count; ++i) {
+            response->add_package_ids(first_id + i);
+        }
+        std::vector<ReadyPackage> ready;
+        ready.reserve(count);
+        for (int32_t i = 0; i < count; ++i) {
+            ready.push_back(ReadyPackage{first_id + i, destinationOf(request->packages(i))});
+        }
+        ready_queue_.pushAll(ready);
+
+        created_packages_counter_->Add(count);
+
+        LOG_SPAN_INFO(ctx, "[SERVER] Created packages ID " << first_id << ".." << first_id + count - 1);
+
+        span->SetAttribute("first_package_id", first_id);
+        span->End();
+
+        auto end = std::chrono::steady_clock::now();
+        std::chrono::duration<double> elapsed = end - start;
+        create_packages_duration_histogram_->Record(elapsed.count(), opentelemetry::context::Context{});
+
+        return finishWhenDurable(reactor);
+    }
 
     Status getPackageStatus(ServerContext* context,
                             const PackageStatusRequest* request,
                             PackageStatusResponse* response) override {
         get_package_status_counter_->Add(1);
-        std::lock_guard<std::mutex> lock(mutex_);
-        for (const auto& pkg : packages_) {
-            if (pkg.package_id == request->package_id()) {
-                response->set_status(pkg.status);
-                return Status::OK;
-            }
+        if (auto status = store_.status(request->package_id())) {
+            response->set_status(*status);
+            return Status::OK;
         }
         not_found_package_status_counter_->Add(1);
 
         auto span = tracer_->StartSpan("get_package_status_not_found");
         auto ctx = span->GetContext();
-        logger_->EmitLogRecord(
-            logs_api::Severity::kWarn,
-            "Package not found: id=" + std::to_string(request->package_id()),
-            ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),
-            opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now())
-        );
+        LOG_SPAN_WARN(ctx, "[SERVER] Package not found: id=" << request->package_id());
         span->End();
 
         return Status(grpc::NOT_FOUND, "Package not found");
     }
 
-    Status updatePackages(ServerContext* context,
-    ServerReaderWriter<PackageInstruction, PackageUpdate>* stream) override {
-        update_packages_requests_counter_->Add(1);
-        PackageUpdate update;
-        auto span = tracer_->StartSpan("update_packages");
-        auto ctx = span->GetContext();
-        logger_->EmitLogRecord(logs_api::Severity::kInfo, "updatePackages called",
-                       ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),
-                       opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now()));
-        while (stream->Read(&update)) {
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
-
-                std::this_thread::sleep_for(std::chrono::milliseconds(80 + rand() % 120));
-                // Handle delivery status
-                if (update.package_id() != -1 && update.status() == PackageStatus::DELIVERED) {
-                    for (auto& pkg : packages_) {
-                        if (pkg.package_id == update.package_id()) {
-                            pkg.status = PackageStatus::DELIVERED;
-                            pkg.delivered_by = update.vehicle_id();
-
-                            std::map<std::string, std::string> labels = {{"vehicle_id", std::to_string(update.vehicle_id())}};
-                            auto labelkv = opentelemetry::common::KeyValueIterableView<decltype(labels)>{labels};
-                            delivered_packages_counter_->Add(1.0, labelkv);
-
-                            std::cout << "[SERVER] Package " << pkg.package_id << " delivered by vehicle "
-                            << update.vehicle_id() << std::endl;
-
-                            span->AddEvent("Package " + std::to_string(pkg.package_id) + " delivered by vehicle " + std::to_string(update.vehicle_id()));
-
-                            break;
-                        }
-                    }
-                }
-            }
-
-
-            std::this_thread::sleep_for(std::chrono::milliseconds(60 + rand() % 100));
-
-            // 🔁 Wait until at least one CREATED package is available
-            std::unique_lock<std::mutex> lock(mutex_);
-            package_available_cv_.wait(lock, [&]() {
-                return std::any_of(packages_.begin(), packages_.end(),
-                                    [](const Package& p) { return p.status == PackageStatus::CREATED; });
-            });
-
-            // Pick a random CREATED package
-            std::vector<Package*> created;
-            for (auto& pkg : packages_) {
-                if (pkg.status == PackageStatus::CREATED) {
-                    created.push_back(&pkg);
-                }
-            }
-
-            if (!created.empty()) {
-                Package* selected = created[rand() % created.size()];
-                selected->status = PackageStatus::IN_TRANSIT;
-
-                PackageInstruction instr;
-                instr.set_package_id(selected->package_id);
-                instr.set_delivery_address(selected->recipient_address);
-
-                std::cout << "[SERVER] Assigned package " << selected->package_id << " to vehicle "
-                << update.vehicle_id() << std::endl;
-
-                span->AddEvent("Assigned package " + std::to_string(selected->package_id) + " to vehicle " + std::to_string(update.vehicle_id()));
-
-
-                std::this_thread::sleep_for(std::chrono::milliseconds(70 + rand() % 100));
+    grpc::ServerWriteReactor<PackageStatusEvent>* watchPackages(
+        grpc::CallbackServerContext* context, const PackageWatchRequest* request) override {
+        watch_packages_requests_counter_->Add(1);
+        return new WatchPackagesReactor(this, *request);
+    }
 
-                stream->Write(instr);
-            } else {
-                logger_->EmitLogRecord(
-                    logs_api::Severity::kInfo,
-                    "No packages available for assignment to vehicle " + std::to_string(update.vehicle_id()),
-                    ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),
-                    opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now())
-                );
-            }
-        }
-        span->End();
-        return Status::OK;
+    grpc::ServerBidiReactor<PackageUpdate, PackageInstruction>* updatePackages(
+        grpc::CallbackServerContext* context) override {
+        update_packages_requests_counter_->Add(1);
+        return new UpdatePackagesReactor(this);
     }
 
     Status getDeliveredCountByVehicle(ServerContext* context, const VehicleQuery* request,
                                       DeliveredCount* response) override {
-        std::lock_guard<std::mutex> lock(mutex_);
-
         auto span = tracer_->StartSpan("get_delivered_count_by_vehicle");
         span->SetAttribute("vehicle_id", request->vehicle_id());
         auto ctx = span->GetContext();
-        logger_->EmitLogRecord(logs_api::Severity::kInfo, "getDeliveredCountByVehicle called",
-                            ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),
-                            opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now()));
-
-        int count = 0;
-        for (const auto& pkg : packages_) {
-            if (pkg.status == PackageStatus::DELIVERED && pkg.delivered_by == request->vehicle_id()) {
-                ++count;
+        LOG_SPAN_INFO(ctx, "[SERVER] getDeliveredCountByVehicle called for vehicle_id=" << request->vehicle_id());
+
+        response->set_count(store_.deliveredCount(request->vehicle_id()));
+        span->End();
+        return Status::OK;
+    }
+
+    Status getDeliveredCounts(ServerContext* context, const VehicleBatchQuery* request,
+                              DeliveredCounts* response) override {
+        if (request->vehicle_ids_size() > kMaxBatchSize) {
+            return Status(grpc::INVALID_ARGUMENT, "Query larger than " + std::to_string(kMaxBatchSize) + " vehicles");
+        }
+        auto span = tracer_->StartSpan("get_delivered_counts");
+        span->SetAttribute("all", request->all());
+        span->SetAttribute("vehicle_count", request->vehicle_ids_size());
+
+        if (request->all()) {
+            store_.forEachDeliveredCount([response](int32_t vehicle_id, int32_t count) {
+                auto* entry = response->add_counts();
+                entry->set_vehicle_id(vehicle_id);
+                entry->set_count(count);
+            });
+        } else {
+            std::vector<int32_t> vehicle_ids(request->vehicle_ids().begin(), request->vehicle_ids().end());
+            std::vector<int32_t> counts = store_.deliveredCounts(vehicle_ids);
+            response->mutable_counts()->Reserve(counts.size());
+            for (size_t i = 0; i < counts.size(); ++i) {
+                auto* entry = response->add_counts();
+                entry->set_vehicle_id(vehicle_ids[i]);
+                entry->set_count(counts[i]);
             }
         }
-
-        response->set_count(count);
+        span->SetAttribute("result_count", response->counts_size());
         span->End();
         return Status::OK;
     }
 };
 
 int main(int argc, char** argv) {
-    initTelemetry();
+    initTelemetry(TelemetryOptions::fromEnv("package-service"));
+    AsyncLog::start(AsyncLog::Options::fromEnv(), logs_api::Provider::GetLoggerProvider()->GetLogger("package-service"));
     std::string server_address("0.0.0.0:50052");
     PackageServiceImpl service;
 
+    PackageWal::Options persistence = PackageWal::optionsFromEnv();
+    if (!persistence.dir.empty()) {
+        service.enablePersistence(persistence);
+    }
+
     ServerBuilder builder;
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
     builder.RegisterService(&service);
@@ -339,6 +617,8 @@ int main(int argc, char** argv) {
     std::cout << "PackageService server listening on " << server_address << std::endl;
 
     server->Wait();
+    AsyncLog::stop();
+    shutdownTelemetry();
 	
     return 0;
 }
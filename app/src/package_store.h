@@ -0,0 +1,692 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "package_service.pb.h"
+#include "spatial_grid.h"
+#include "string_table.h"
+
+struct Package {
+    int package_id;
+    int delivered_by;
+    std::string sender_address;
+    std::string recipient_address;
+    packages::PackageStatus status;
+    std::optional<GeoPoint> destination;
+};
+
+inline std::optional<GeoPoint> destinationOf(const packages::PackageData& data) {
+    if (!data.has_destination()) {
+        return std::nullopt;
+    }
+    return GeoPoint{data.destination().latitude(), data.destination().longitude()};
+}
+
+// A CREATED package as the dispatcher sees it.
+struct ReadyPackage {
+    int32_t package_id;
+    std::optional<GeoPoint> destination;
+};
+
+// Notified of every package change while the owning shard is still
+// locked, so per-package notifications arrive in the order they applied.
+// Implementations must be cheap and must not call back into the store.
+class PackageObserver {
+public:
+    virtual ~PackageObserver() = default;
+    virtual void onCreated(const Package& pkg) = 0;
+    virtual void onStatusChanged(const Package& pkg) = 0;
+};
+
+// Delivered packages, moved out of the hot store. Only what status and
+// delivered-count queries need is kept: one int32 vehicle id per package,
+// in fixed-size segments indexed directly by package id. Thread-safe.
+class DeliveredArchive {
+public:
+    void put(int32_t package_id, int32_t vehicle_id) {
+        if (package_id < 0) {
+            return;
+        }
+        size_t index = static_cast<size_t>(package_id) / kSegmentSize;
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            if (index < segments_.size() && segments_[index]) {
+                segments_[index]->delivered_by[package_id % kSegmentSize].store(vehicle_id, std::memory_order_relaxed);
+                return;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (index >= segments_.size()) {
+            segments_.resize(index + 1);
+        }
+        if (!segments_[index]) {
+            segments_[index] = std::make_unique<Segment>();
+        }
+        segments_[index]->delivered_by[package_id % kSegmentSize].store(vehicle_id, std::memory_order_relaxed);
+    }
+
+    // Recovery: forgets a package replayed as delivered that a later record undelivered.
+    void remove(int32_t package_id) {
+        if (package_id < 0) {
+            return;
+        }
+        size_t index = static_cast<size_t>(package_id) / kSegmentSize;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        if (index < segments_.size() && segments_[index]) {
+            segments_[index]->delivered_by[package_id % kSegmentSize].store(kEmpty, std::memory_order_relaxed);
+        }
+    }
+
+    std::optional<int32_t> deliveredBy(int32_t package_id) const {
+        if (package_id < 0) {
+            return std::nullopt;
+        }
+        size_t index = static_cast<size_t>(package_id) / kSegmentSize;
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        if (index >= segments_.size() || !segments_[index]) {
+            return std::nullopt;
+        }
+        int32_t vehicle_id = segments_[index]->delivered_by[package_id % kSegmentSize].load(std::memory_order_relaxed);
+        if (vehicle_id == kEmpty) {
+            return std::nullopt;
+        }
+        return vehicle_id;
+    }
+
+    // Visits (package_id, vehicle_id) for every archived package. Segments
+    // are never freed, so fn runs without the lock and may block.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (size_t index = 0;; ++index) {
+            const Segment* segment;
+            {
+                std::shared_lock<std::shared_mutex> lock(mutex_);
+                if (index >= segments_.size()) {
+                    return;
+                }
+                segment = segments_[index].get();
+            }
+            if (!segment) {
+                continue;
+            }
+            for (size_t i = 0; i < kSegmentSize; ++i) {
+                int32_t vehicle_id = segment->delivered_by[i].load(std::memory_order_relaxed);
+                if (vehicle_id != kEmpty) {
+                    fn(static_cast<int32_t>(index * kSegmentSize + i), vehicle_id);
+                }
+            }
+        }
+    }
+
+    // Copies each allocated segment out and calls fn(index, slots), where
+    // slot i holds the vehicle that delivered package index * kSegmentSize + i,
+    // or kEmpty. Segments are never freed, so fn runs without the lock.
+    template <typename Fn>
+    void forEachSegment(Fn&& fn) const {
+        std::vector<int32_t> slots(kSegmentSize);
+        for (size_t index = 0;; ++index) {
+            const Segment* segment;
+            {
+                std::shared_lock<std::shared_mutex> lock(mutex_);
+                if (index >= segments_.size()) {
+                    return;
+                }
+                segment = segments_[index].get();
+            }
+            if (!segment) {
+                continue;
+            }
+            for (size_t i = 0; i < kSegmentSize; ++i) {
+                slots[i] = segment->delivered_by[i].load(std::memory_order_relaxed);
+            }
+            fn(static_cast<uint32_t>(index), slots);
+        }
+    }
+
+    // Recovery: replaces a whole segment with slots from forEachSegment().
+    void loadSegment(uint32_t index, const int32_t* slots) {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        if (index >= segments_.size()) {
+            segments_.resize(index + 1);
+        }
+        if (!segments_[index]) {
+            segments_[index] = std::make_unique<Segment>();
+        }
+        for (size_t i = 0; i < kSegmentSize; ++i) {
+            segments_[index]->delivered_by[i].store(slots[i], std::memory_order_relaxed);
+        }
+    }
+
+    // Highest archived package id, or 0. Looks at the last segments only.
+    int32_t maxId() const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        for (size_t index = segments_.size(); index-- > 0;) {
+            if (!segments_[index]) {
+                continue;
+            }
+            for (size_t i = kSegmentSize; i-- > 0;) {
+                if (segments_[index]->delivered_by[i].load(std::memory_order_relaxed) != kEmpty) {
+                    return static_cast<int32_t>(index * kSegmentSize + i);
+                }
+            }
+        }
+        return 0;
+    }
+
+    static constexpr size_t kSegmentSize = 1 << 16;
+    // Marks a free slot, so markDelivered rejects it as a vehicle id
+    static constexpr int32_t kEmpty = std::numeric_limits<int32_t>::min();
+
+private:
+    struct Segment {
+        Segment() {
+            for (auto& slot : delivered_by) {
+                slot.store(kEmpty, std::memory_order_relaxed);
+            }
+        }
+        std::array<std::atomic<int32_t>, kSegmentSize> delivered_by;
+    };
+
+    mutable std::shared_mutex mutex_;
+    std::vector<std::unique_ptr<Segment>> segments_;
+};
+
+// Package records indexed by id, with delivered counts per vehicle and
+// package counts per status kept up to date on every transition.
+// Packages and delivered counters are split into lock-striped shards
+// guarded by reader/writer locks, so status reads only share a lock with
+// writers touching the same shard.
+// Hot records store an interned id for the sender address, which repeats
+// heavily, and the recipient inline, so it is freed with the record.
+// Delivered packages leave the hot shards for the DeliveredArchive, which
+// keeps only the delivering vehicle.
+class PackageStore {
+public:
+    static constexpr size_t kShards = 64;
+
+    Package create(const packages::PackageData& data) {
+        int32_t package_id = next_id_.fetch_add(1, std::memory_order_relaxed);
+        PackageRecord record = makeRecord(data);
+
+        PackageShard& shard = packageShard(package_id);
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            shard.packages.emplace(package_id, record);
+            notifyCreated(package_id, record);
+        }
+        status_counts_[packages::PackageStatus::CREATED].fetch_add(1, std::memory_order_relaxed);
+        return materialize(package_id, record);
+    }
+
+    // Allocates one contiguous id range for the whole batch and inserts it
+    // taking each shard lock once. Returns the first id of the range.
+    int32_t createBatch(const google::protobuf::RepeatedPtrField<packages::PackageData>& batch) {
+        const int32_t count = batch.size();
+        const int32_t first_id = next_id_.fetch_add(count, std::memory_order_relaxed);
+        std::vector<PackageRecord> records;
+        records.reserve(count);
+        for (const auto& data : batch) {
+            records.push_back(makeRecord(data));
+        }
+        // Ids are striped by id % kShards, so every kShards-th element of the batch lands in the same shard
+        for (int32_t offset = 0; offset < count && offset < static_cast<int32_t>(kShards); ++offset) {
+            PackageShard& shard = packageShard(first_id + offset);
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            for (int32_t i = offset; i < count; i += kShards) {
+                auto it = shard.packages.emplace(first_id + i, std::move(records[i])).first;
+                notifyCreated(first_id + i, it->second);
+            }
+        }
+        status_counts_[packages::PackageStatus::CREATED].fetch_add(count, std::memory_order_relaxed);
+        return first_id;
+    }
+
+    std::optional<Package> find(int32_t package_id) const {
+        {
+            const PackageShard& shard = packageShard(package_id);
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.packages.find(package_id);
+            if (it != shard.packages.end()) {
+                return materialize(package_id, it->second);
+            }
+        }
+        if (auto vehicle_id = archive_.deliveredBy(package_id)) {
+            return archived(package_id, *vehicle_id);
+        }
+        return std::nullopt;
+    }
+
+    std::optional<packages::PackageStatus> status(int32_t package_id) const {
+        {
+            const PackageShard& shard = packageShard(package_id);
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.packages.find(package_id);
+            if (it != shard.packages.end()) {
+                return it->second.status;
+            }
+        }
+        // Delivery archives before it leaves the shard, so a miss above is never a false negative here
+        if (archive_.deliveredBy(package_id)) {
+            return packages::PackageStatus::DELIVERED;
+        }
+        return std::nullopt;
+    }
+
+    // Moves a package between CREATED and IN_TRANSIT. Returns false if it
+    // does not exist or is not in the expected status.
+    bool transition(int32_t package_id, packages::PackageStatus from, packages::PackageStatus to) {
+        {
+            PackageShard& shard = packageShard(package_id);
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.packages.find(package_id);
+            if (it == shard.packages.end() || it->second.status != from) {
+                return false;
+            }
+            it->second.status = to;
+            notifyStatusChanged(package_id, it->second);
+        }
+        countTransition(from, to);
+        return true;
+    }
+
+    // Moves the package to the archive. Returns false if it does not exist,
+    // was already delivered or `vehicle_id` is the archive's empty marker.
+    bool markDelivered(int32_t package_id, int32_t vehicle_id) {
+        if (vehicle_id == DeliveredArchive::kEmpty) {
+            return false;
+        }
+        packages::PackageStatus previous;
+        {
+            PackageShard& shard = packageShard(package_id);
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.packages.find(package_id);
+            if (it == shard.packages.end()) {
+                return false;
+            }
+            previous = it->second.status;
+            archive_.put(package_id, vehicle_id);
+            shard.packages.erase(it);
+            notifyStatusChanged(archived(package_id, vehicle_id));
+        }
+        countTransition(previous, packages::PackageStatus::DELIVERED);
+
+        VehicleShard& shard = vehicleShard(vehicle_id);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        ++shard.delivered[vehicle_id];
+        return true;
+    }
+
+    int32_t deliveredCount(int32_t vehicle_id) const {
+        const VehicleShard& shard = vehicleShard(vehicle_id);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.delivered.find(vehicle_id);
+        return it == shard.delivered.end() ? 0 : it->second;
+    }
+
+    // Delivered counts for many vehicles, in request order, taking each
+    // vehicle shard's lock once.
+    std::vector<int32_t> deliveredCounts(const std::vector<int32_t>& vehicle_ids) const {
+        std::vector<int32_t> counts(vehicle_ids.size(), 0);
+        std::array<std::vector<size_t>, kShards> by_shard;
+        for (size_t i = 0; i < vehicle_ids.size(); ++i) {
+            by_shard[static_cast<uint32_t>(vehicle_ids[i]) % kShards].push_back(i);
+        }
+        for (size_t s = 0; s < kShards; ++s) {
+            if (by_shard[s].empty()) {
+                continue;
+            }
+            std::shared_lock<std::shared_mutex> lock(vehicle_shards_[s].mutex);
+            for (size_t i : by_shard[s]) {
+                auto it = vehicle_shards_[s].delivered.find(vehicle_ids[i]);
+                if (it != vehicle_shards_[s].delivered.end()) {
+                    counts[i] = it->second;
+                }
+            }
+        }
+        return counts;
+    }
+
+    // Visits (vehicle_id, delivered count) for every vehicle that delivered.
+    template <typename Fn>
+    void forEachDeliveredCount(Fn&& fn) const {
+        for (const auto& shard : vehicle_shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            for (const auto& entry : shard.delivered) {
+                fn(entry.first, entry.second);
+            }
+        }
+    }
+
+    size_t countByStatus(packages::PackageStatus status) const {
+        return status_counts_[status].load(std::memory_order_relaxed);
+    }
+
+    // Observers must be added before the store is shared between threads.
+    void addObserver(PackageObserver* observer) { observers_.push_back(observer); }
+
+    // Recovery: inserts or overwrites a package as-is, without notifications.
+    // Delivered counts follow the archive as packages enter or leave it;
+    // the other counters wait for finishRestore(), which must run once all
+    // packages are in.
+    void restore(const Package& pkg) {
+        PackageShard& shard = packageShard(pkg.package_id);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto archived_by = archive_.deliveredBy(pkg.package_id);
+        if (pkg.status == packages::PackageStatus::DELIVERED) {
+            shard.packages.erase(pkg.package_id);
+            if (archived_by == pkg.delivered_by) {
+                return;
+            }
+            if (archived_by) {
+                addDelivered(*archived_by, -1);
+            }
+            archive_.put(pkg.package_id, pkg.delivered_by);
+            addDelivered(pkg.delivered_by, 1);
+            return;
+        }
+        // Delivered in the snapshot, but a later record says otherwise
+        if (archived_by) {
+            archive_.remove(pkg.package_id);
+            addDelivered(*archived_by, -1);
+        }
+        PackageRecord record;
+        record.sender = senders_.intern(pkg.sender_address);
+        record.recipient = pkg.recipient_address;
+        record.status = pkg.status;
+        record.has_destination = pkg.destination.has_value();
+        record.destination = pkg.destination.value_or(GeoPoint{0, 0});
+        shard.packages[pkg.package_id] = std::move(record);
+    }
+
+    // Recovery: loads an archive segment and the delivered counts saved by
+    // a snapshot, before any restore() of the records that follow it.
+    void restoreArchiveSegment(uint32_t index, const int32_t* slots) { archive_.loadSegment(index, slots); }
+
+    void restoreDeliveredCount(int32_t vehicle_id, int32_t count) { addDelivered(vehicle_id, count); }
+
+    // Rebuilds the status counters and the id allocator after restore().
+    // Only the hot shards are walked; delivered packages are already
+    // counted per vehicle. Packages left IN_TRANSIT lost their vehicle
+    // stream, so they go back to CREATED. Returns the CREATED packages in
+    // id order.
+    std::vector<ReadyPackage> finishRestore() {
+        std::vector<ReadyPackage> created;
+        std::array<size_t, packages::PackageStatus_ARRAYSIZE> counts{};
+        int32_t max_id = 0;
+        for (auto& shard : package_shards_) {
+            std::unique_lock<std::shared_mutex> lock(shard.mutex);
+            for (auto& entry : shard.packages) {
+                PackageRecord& record = entry.second;
+                record.status = packages::PackageStatus::CREATED;
+                created.push_back(ReadyPackage{entry.first, recordDestination(record)});
+                ++counts[record.status];
+                max_id = std::max(max_id, entry.first);
+            }
+        }
+        forEachDeliveredCount([&](int32_t, int32_t count) { counts[packages::PackageStatus::DELIVERED] += count; });
+        max_id = std::max(max_id, archive_.maxId());
+        for (size_t i = 0; i < counts.size(); ++i) {
+            status_counts_[i].store(counts[i], std::memory_order_relaxed);
+        }
+        next_id_.store(max_id + 1, std::memory_order_relaxed);
+        std::sort(created.begin(), created.end(), [](const ReadyPackage& a, const ReadyPackage& b) {
+            return a.package_id < b.package_id;
+        });
+        return created;
+    }
+
+    // Visits every package, hot ones under their shard's shared lock.
+    // Archived packages are visited without addresses.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (const auto& shard : package_shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            for (const auto& entry : shard.packages) {
+                fn(materialize(entry.first, entry.second));
+            }
+        }
+        archive_.forEach([&](int32_t package_id, int32_t vehicle_id) {
+            fn(archived(package_id, vehicle_id));
+        });
+    }
+
+    // Visits the packages not yet delivered. Each hot shard is copied out
+    // under its lock and fn runs after the lock is released, so fn may
+    // block (e.g. on disk).
+    template <typename Fn>
+    void forEachLiveCopied(Fn&& fn) const {
+        std::vector<Package> copied;
+        for (const auto& shard : package_shards_) {
+            copied.clear();
+            {
+                std::shared_lock<std::shared_mutex> lock(shard.mutex);
+                copied.reserve(shard.packages.size());
+                for (const auto& entry : shard.packages) {
+                    copied.push_back(materialize(entry.first, entry.second));
+                }
+            }
+            for (const Package& pkg : copied) {
+                fn(pkg);
+            }
+        }
+    }
+
+    // Copies out the delivered archive, see DeliveredArchive::forEachSegment().
+    template <typename Fn>
+    void forEachArchiveSegment(Fn&& fn) const {
+        archive_.forEachSegment(std::forward<Fn>(fn));
+    }
+
+private:
+    // Senders live once in senders_; recipients are mostly unique, and
+    // interning them would keep every address ever seen alive.
+    struct PackageRecord {
+        uint32_t sender;
+        std::string recipient;
+        packages::PackageStatus status;
+        bool has_destination;
+        GeoPoint destination;
+    };
+
+    struct PackageShard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<int32_t, PackageRecord> packages;
+    };
+
+    struct VehicleShard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<int32_t, int32_t> delivered;
+    };
+
+    PackageRecord makeRecord(const packages::PackageData& data) {
+        PackageRecord record;
+        record.sender = senders_.intern(data.sender_address());
+        record.recipient = data.recipient_address();
+        record.status = packages::PackageStatus::CREATED;
+        record.has_destination = data.has_destination();
+        record.destination = destinationOf(data).value_or(GeoPoint{0, 0});
+        return record;
+    }
+
+    static std::optional<GeoPoint> recordDestination(const PackageRecord& record) {
+        if (!record.has_destination) {
+            return std::nullopt;
+        }
+        return record.destination;
+    }
+
+    Package materialize(int32_t package_id, const PackageRecord& record) const {
+        Package pkg;
+        pkg.package_id = package_id;
+        pkg.delivered_by = -1;
+        pkg.sender_address = senders_.get(record.sender);
+        pkg.recipient_address = record.recipient;
+        pkg.status = record.status;
+        pkg.destination = recordDestination(record);
+        return pkg;
+    }
+
+    static Package archived(int32_t package_id, int32_t vehicle_id) {
+        Package pkg;
+        pkg.package_id = package_id;
+        pkg.delivered_by = vehicle_id;
+        pkg.status = packages::PackageStatus::DELIVERED;
+        return pkg;
+    }
+
+    PackageShard& packageShard(int32_t package_id) {
+        return package_shards_[static_cast<uint32_t>(package_id) % kShards];
+    }
+
+    const PackageShard& packageShard(int32_t package_id) const {
+        return package_shards_[static_cast<uint32_t>(package_id) % kShards];
+    }
+
+    VehicleShard& vehicleShard(int32_t vehicle_id) {
+        return vehicle_shards_[static_cast<uint32_t>(vehicle_id) % kShards];
+    }
+
+    const VehicleShard& vehicleShard(int32_t vehicle_id) const {
+        return vehicle_shards_[static_cast<uint32_t>(vehicle_id) % kShards];
+    }
+
+    void notifyCreated(int32_t package_id, const PackageRecord& record) {
+        if (observers_.empty()) {
+            return;
+        }
+        Package pkg = materialize(package_id, record);
+        for (PackageObserver* observer : observers_) {
+            observer->onCreated(pkg);
+        }
+    }
+
+    void notifyStatusChanged(int32_t package_id, const PackageRecord& record) {
+        if (observers_.empty()) {
+            return;
+        }
+        notifyStatusChanged(materialize(package_id, record));
+    }
+
+    void notifyStatusChanged(const Package& pkg) {
+        for (PackageObserver* observer : observers_) {
+            observer->onStatusChanged(pkg);
+        }
+    }
+
+    void addDelivered(int32_t vehicle_id, int32_t delta) {
+        VehicleShard& shard = vehicleShard(vehicle_id);
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        int32_t& count = shard.delivered[vehicle_id];
+        count += delta;
+        if (count <= 0) {
+            shard.delivered.erase(vehicle_id);
+        }
+    }
+
+    void countTransition(packages::PackageStatus from, packages::PackageStatus to) {
+        status_counts_[from].fetch_sub(1, std::memory_order_relaxed);
+        status_counts_[to].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    std::array<PackageShard, kShards> package_shards_;
+    std::array<VehicleShard, kShards> vehicle_shards_;
+    DeliveredArchive archive_;
+    StringTable senders_;
+    std::array<std::atomic<size_t>, packages::PackageStatus_ARRAYSIZE> status_counts_{};
+    std::atomic<int32_t> next_id_{1};
+    std::vector<PackageObserver*> observers_;
+};
+
+// Packages waiting for a vehicle, and vehicles waiting for a package.
+// Packages with a destination sit in a spatial grid so a vehicle that
+// reports its position gets the nearest one; the rest wait in FIFO order.
+// A new package goes straight to the longest waiting vehicle, so each push
+// wakes at most one stream. Waiters are callbacks rather than blocked
+// threads. Has its own lock, independent of the store shards.
+class ReadyQueue {
+public:
+    using Callback = std::function<void(int32_t)>;
+
+    void push(const ReadyPackage& pkg) {
+        pushAll({pkg});
+    }
+
+    // Queues the packages, handing them to waiting vehicles first.
+    void pushAll(const std::vector<ReadyPackage>& pkgs) {
+        std::vector<std::pair<Callback, int32_t>> handed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (const ReadyPackage& pkg : pkgs) {
+                if (!waiters_.empty()) {
+                    handed.emplace_back(std::move(waiters_.front().second), pkg.package_id);
+                    waiter_index_.erase(waiters_.front().first);
+                    waiters_.pop_front();
+                } else if (pkg.destination) {
+                    by_destination_.insert(pkg.package_id, *pkg.destination);
+                } else {
+                    fifo_.push_back(pkg.package_id);
+                }
+            }
+        }
+        for (auto& entry : handed) {
+            entry.first(entry.second);
+        }
+    }
+
+    // Returns a ready package id, the nearest to `position` when one is
+    // given, or -1 after queueing `on_ready` to be called with the next
+    // pushed id. `ticket` identifies the queued waiter for cancel().
+    int32_t popOrWait(std::optional<GeoPoint> position, Callback on_ready, uint64_t* ticket) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!by_destination_.empty() && (position || fifo_.empty())) {
+            auto nearest = by_destination_.nearest(position.value_or(GeoPoint{0, 0}));
+            by_destination_.remove(nearest->first);
+            return nearest->first;
+        }
+        if (!fifo_.empty()) {
+            int32_t package_id = fifo_.front();
+            fifo_.pop_front();
+            return package_id;
+        }
+        *ticket = next_ticket_++;
+        waiters_.emplace_back(*ticket, std::move(on_ready));
+        waiter_index_[*ticket] = std::prev(waiters_.end());
+        return -1;
+    }
+
+    // Returns false if the waiter was already handed a package.
+    bool cancel(uint64_t ticket) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto it = waiter_index_.find(ticket);
+        if (it == waiter_index_.end()) {
+            return false;
+        }
+        waiters_.erase(it->second);
+        waiter_index_.erase(it);
+        return true;
+    }
+
+private:
+    using WaiterList = std::list<std::pair<uint64_t, Callback>>;
+
+    std::mutex mutex_;
+    std::deque<int32_t> fifo_;
+    SpatialGrid by_destination_;
+    WaiterList waiters_;
+    std::unordered_map<uint64_t, WaiterList::iterator> waiter_index_;
+    uint64_t next_ticket_ = 0;
+};
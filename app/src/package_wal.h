@@ -0,0 +1,592 @@
+#pragma once
+
+#include <chrono>
+#include <cinttypes>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "package_store.h"
+
+// Durable form of the package store: an append-only write-ahead log of
+// package changes plus periodic snapshots.
+//
+// Changes are encoded into an in-memory buffer that a background thread
+// writes and fdatasyncs in one go (group commit). A handler that must not
+// acknowledge before its change is durable registers with whenDurable()
+// and finishes from the callback: the flusher syncs as soon as anyone is
+// waiting, and one fdatasync releases every change appended before it,
+// so no thread blocks per call. Changes nobody waits for are synced
+// every flush interval and can be lost if the process dies within that
+// window (assignments and deliveries). A batch that fails to reach the
+// disk is retried in a fresh segment, after a growing delay, and holds
+// back every waiter after it, so the log never has a hole. Every snapshot-interval the log is
+// rotated to a new segment and the store is dumped to
+// snapshot-<segment>.bin, after which older segments are deleted. The
+// snapshot holds the live packages as records and the delivered archive
+// as raw segments with its per-vehicle counts, so recovery copies the
+// archive in bulk and replays only the live packages and the segments
+// written after the snapshot.
+//
+// Each record carries the full resulting state of one package, so replay
+// is idempotent and a snapshot taken while writes continue stays valid.
+class PackageWal : public PackageObserver {
+public:
+    struct Options {
+        std::string dir;
+        std::chrono::milliseconds flush_interval{50};
+        std::chrono::seconds snapshot_interval{60};
+    };
+
+    // PACKAGE_DATA_DIR enables persistence. PACKAGE_WAL_FLUSH_MS and
+    // PACKAGE_SNAPSHOT_INTERVAL_S tune the flush and snapshot cadence.
+    static Options optionsFromEnv() {
+        Options options;
+        if (const char* dir = std::getenv("PACKAGE_DATA_DIR")) {
+            options.dir = dir;
+        }
+        if (const char* flush_ms = std::getenv("PACKAGE_WAL_FLUSH_MS")) {
+            options.flush_interval = std::chrono::milliseconds(std::max(1, std::atoi(flush_ms)));
+        }
+        if (const char* snapshot_s = std::getenv("PACKAGE_SNAPSHOT_INTERVAL_S")) {
+            options.snapshot_interval = std::chrono::seconds(std::max(1, std::atoi(snapshot_s)));
+        }
+        return options;
+    }
+
+    PackageWal(Options options, PackageStore& store) : options_(std::move(options)), store_(store) {}
+
+    ~PackageWal() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        if (flusher_.joinable()) {
+            flusher_.join();
+        }
+        if (!flush()) {
+            std::deque<Waiter> failed;
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                failed.swap(waiters_);
+            }
+            for (Waiter& waiter : failed) {
+                waiter.done(false);
+            }
+        }
+        if (fd_ != -1) {
+            ::close(fd_);
+        }
+    }
+
+    // Loads the latest snapshot and the log tail into the store. Returns the
+    // packages waiting for assignment, in id order.
+    std::vector<ReadyPackage> recover() {
+        std::filesystem::create_directories(options_.dir);
+
+        uint64_t snapshot_seq = 0;
+        std::map<uint64_t, std::filesystem::path> segments;
+        for (const auto& entry : std::filesystem::directory_iterator(options_.dir)) {
+            uint64_t seq;
+            std::string name = entry.path().filename().string();
+            if (parseName(name, "snapshot-", ".bin", seq)) {
+                snapshot_seq = std::max(snapshot_seq, seq);
+            } else if (parseName(name, "wal-", ".log", seq)) {
+                segments[seq] = entry.path();
+            }
+        }
+
+        size_t snapshot_records = 0;
+        if (snapshot_seq > 0) {
+            snapshot_records = replayFile(snapshotPath(snapshot_seq));
+        }
+        size_t tail_records = 0;
+        for (const auto& segment : segments) {
+            if (segment.first >= snapshot_seq) {
+                tail_records += replayFile(segment.second);
+            }
+        }
+        segment_seq_ = std::max(snapshot_seq, segments.empty() ? 0 : segments.rbegin()->first) + 1;
+
+        std::cout << "[WAL] Recovered " << snapshot_records << " packages from the snapshot and "
+                  << tail_records << " records from the log tail" << std::endl;
+        return store_.finishRestore();
+    }
+
+    // Opens a fresh log segment and starts the background flusher. If the
+    // segment cannot be opened, the first flush reports it and keeps retrying.
+    void start() {
+        openSegment(segment_seq_);
+        last_snapshot_ = std::chrono::steady_clock::now();
+        flusher_ = std::thread([this]() { run(); });
+    }
+
+    // Runs done(true) once every change appended so far is on disk. Failed
+    // writes are retried, so done(false) only comes at shutdown if the log
+    // still could not be written. Runs on the flusher thread, or inline
+    // when nothing is pending.
+    void whenDurable(std::function<void(bool)> done) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (appended_ > durable_) {
+                waiters_.push_back(Waiter{appended_, std::move(done)});
+                cv_.notify_one();
+                return;
+            }
+        }
+        done(true);
+    }
+
+    void onCreated(const Package& pkg) override { append(pkg); }
+
+    void onStatusChanged(const Package& pkg) override { append(pkg); }
+
+private:
+    // Version 1 snapshots hold only records, delivered packages included
+    static constexpr char kSnapshotMagicV1[8] = {'P', 'K', 'G', 'S', 'N', 'A', 'P', '1'};
+    static constexpr char kSnapshotMagic[8] = {'P', 'K', 'G', 'S', 'N', 'A', 'P', '2'};
+    // Index that ends the archive segments of a snapshot
+    static constexpr uint32_t kArchiveEnd = 0xFFFFFFFF;
+    static constexpr std::chrono::milliseconds kMaxRetryDelay{5000};
+
+    // Frame: u32 payload length, u32 checksum, payload.
+    // Payload: i32 id, u8 status, i32 delivered_by, u32 + sender, u32 + recipient,
+    // u8 has_destination, then f64 latitude and f64 longitude if set.
+    static void encode(const Package& pkg, std::string& out) {
+        std::string payload;
+        payload.reserve(38 + pkg.sender_address.size() + pkg.recipient_address.size());
+        putRaw(payload, pkg.package_id);
+        payload.push_back(static_cast<char>(pkg.status));
+        putRaw(payload, pkg.delivered_by);
+        putString(payload, pkg.sender_address);
+        putString(payload, pkg.recipient_address);
+        payload.push_back(pkg.destination ? 1 : 0);
+        if (pkg.destination) {
+            putRaw(payload, pkg.destination->latitude);
+            putRaw(payload, pkg.destination->longitude);
+        }
+
+        putRaw(out, static_cast<uint32_t>(payload.size()));
+        putRaw(out, checksum(payload.data(), payload.size()));
+        out += payload;
+    }
+
+    // Returns false on a truncated or corrupt record.
+    static bool decode(const char*& pos, const char* end, Package& pkg) {
+        uint32_t size, sum;
+        if (!getRaw(pos, end, size) || !getRaw(pos, end, sum) || static_cast<size_t>(end - pos) < size ||
+            checksum(pos, size) != sum) {
+            return false;
+        }
+        const char* payload_end = pos + size;
+        uint8_t status = 0;
+        bool ok = getRaw(pos, payload_end, pkg.package_id) && getRaw(pos, payload_end, status) &&
+                  getRaw(pos, payload_end, pkg.delivered_by) && getString(pos, payload_end, pkg.sender_address) &&
+                  getString(pos, payload_end, pkg.recipient_address) && packages::PackageStatus_IsValid(status);
+        pkg.status = static_cast<packages::PackageStatus>(status);
+        uint8_t has_destination = 0;
+        GeoPoint destination{0, 0};
+        pkg.destination.reset();
+        if (ok && getRaw(pos, payload_end, has_destination) && has_destination) {
+            ok = getRaw(pos, payload_end, destination.latitude) && getRaw(pos, payload_end, destination.longitude);
+            pkg.destination = destination;
+        }
+        pos = payload_end;
+        return ok;
+    }
+
+    template <typename T>
+    static void putRaw(std::string& out, T value) {
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    static void putString(std::string& out, const std::string& value) {
+        putRaw(out, static_cast<uint32_t>(value.size()));
+        out += value;
+    }
+
+    template <typename T>
+    static bool getRaw(const char*& pos, const char* end, T& value) {
+        if (static_cast<size_t>(end - pos) < sizeof(value)) {
+            return false;
+        }
+        std::memcpy(&value, pos, sizeof(value));
+        pos += sizeof(value);
+        return true;
+    }
+
+    static bool getString(const char*& pos, const char* end, std::string& value) {
+        uint32_t size;
+        if (!getRaw(pos, end, size) || static_cast<size_t>(end - pos) < size) {
+            return false;
+        }
+        value.assign(pos, size);
+        pos += size;
+        return true;
+    }
+
+    // FNV-1a
+    static uint32_t checksum(const char* data, size_t size) {
+        uint32_t hash = 2166136261u;
+        for (size_t i = 0; i < size; ++i) {
+            hash = (hash ^ static_cast<uint8_t>(data[i])) * 16777619u;
+        }
+        return hash;
+    }
+
+    // Matches <prefix><digits><suffix> exactly, so leftover .tmp files are skipped.
+    static bool parseName(const std::string& name, const std::string& prefix, const std::string& suffix, uint64_t& seq) {
+        if (name.size() <= prefix.size() + suffix.size() || name.compare(0, prefix.size(), prefix) != 0 ||
+            name.compare(name.size() - suffix.size(), suffix.size(), suffix) != 0) {
+            return false;
+        }
+        std::string digits = name.substr(prefix.size(), name.size() - prefix.size() - suffix.size());
+        if (digits.find_first_not_of("0123456789") != std::string::npos) {
+            return false;
+        }
+        seq = std::stoull(digits);
+        return true;
+    }
+
+    std::string snapshotPath(uint64_t seq) const {
+        char name[64];
+        std::snprintf(name, sizeof(name), "snapshot-%08" PRIu64 ".bin", seq);
+        return (std::filesystem::path(options_.dir) / name).string();
+    }
+
+    std::string segmentPath(uint64_t seq) const {
+        char name[64];
+        std::snprintf(name, sizeof(name), "wal-%08" PRIu64 ".log", seq);
+        return (std::filesystem::path(options_.dir) / name).string();
+    }
+
+    // Maps the file and applies its records to the store, stopping at the
+    // first torn or corrupt record. Returns the number of records applied.
+    size_t replayFile(const std::filesystem::path& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd == -1) {
+            return 0;
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            return 0;
+        }
+        void* data = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED) {
+            std::cerr << "[WAL] Failed to map " << path << std::endl;
+            return 0;
+        }
+        ::madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+        const char* pos = static_cast<const char*>(data);
+        const char* end = pos + st.st_size;
+        bool snapshot = path.filename().string().rfind("snapshot-", 0) == 0;
+        if (snapshot) {
+            bool v1 = st.st_size >= static_cast<off_t>(sizeof(kSnapshotMagic)) &&
+                      std::memcmp(pos, kSnapshotMagicV1, sizeof(kSnapshotMagicV1)) == 0;
+            bool v2 = st.st_size >= static_cast<off_t>(sizeof(kSnapshotMagic)) &&
+                      std::memcmp(pos, kSnapshotMagic, sizeof(kSnapshotMagic)) == 0;
+            if (!v1 && !v2) {
+                std::cerr << "[WAL] Ignoring snapshot with bad header: " << path << std::endl;
+                ::munmap(data, st.st_size);
+                return 0;
+            }
+            pos += sizeof(kSnapshotMagic);
+            if (v2 && !loadArchive(pos, end)) {
+                std::cerr << "[WAL] Stopped replay of " << path << " at a corrupt archive section" << std::endl;
+                ::munmap(data, st.st_size);
+                return 0;
+            }
+        }
+
+        size_t records = 0;
+        Package pkg;
+        while (pos < end && decode(pos, end, pkg)) {
+            store_.restore(pkg);
+            ++records;
+        }
+        if (pos < end) {
+            std::cerr << "[WAL] Stopped replay of " << path << " at a torn record" << std::endl;
+        }
+        ::munmap(data, st.st_size);
+        return records;
+    }
+
+    // Snapshot archive section: segments as u32 index, u32 checksum and
+    // kSegmentSize i32 slots, ended by kArchiveEnd; then u32 vehicle count,
+    // u32 checksum and (i32 vehicle_id, i32 delivered) pairs.
+    static void encodeArchiveSegment(uint32_t index, const std::vector<int32_t>& slots, std::string& out) {
+        const char* bytes = reinterpret_cast<const char*>(slots.data());
+        size_t size = slots.size() * sizeof(int32_t);
+        putRaw(out, index);
+        putRaw(out, checksum(bytes, size));
+        out.append(bytes, size);
+    }
+
+    static void encodeDeliveredCounts(const std::unordered_map<int32_t, int32_t>& counts, std::string& out) {
+        std::string pairs;
+        pairs.reserve(counts.size() * 2 * sizeof(int32_t));
+        for (const auto& [vehicle_id, count] : counts) {
+            putRaw(pairs, vehicle_id);
+            putRaw(pairs, count);
+        }
+        putRaw(out, kArchiveEnd);
+        putRaw(out, static_cast<uint32_t>(counts.size()));
+        putRaw(out, checksum(pairs.data(), pairs.size()));
+        out += pairs;
+    }
+
+    // Copies the archive section into the store. Returns false if it is torn or corrupt.
+    bool loadArchive(const char*& pos, const char* end) {
+        const size_t segment_size = DeliveredArchive::kSegmentSize * sizeof(int32_t);
+        std::vector<int32_t> slots(DeliveredArchive::kSegmentSize);
+        size_t segments = 0;
+        uint32_t index = 0, sum;
+        while (getRaw(pos, end, index) && index != kArchiveEnd) {
+            if (!getRaw(pos, end, sum) || static_cast<size_t>(end - pos) < segment_size ||
+                checksum(pos, segment_size) != sum) {
+                return false;
+            }
+            std::memcpy(slots.data(), pos, segment_size);
+            store_.restoreArchiveSegment(index, slots.data());
+            pos += segment_size;
+            ++segments;
+        }
+        uint32_t vehicles;
+        if (index != kArchiveEnd || !getRaw(pos, end, vehicles) || !getRaw(pos, end, sum) ||
+            static_cast<size_t>(end - pos) < vehicles * 2 * sizeof(int32_t) ||
+            checksum(pos, vehicles * 2 * sizeof(int32_t)) != sum) {
+            return false;
+        }
+        for (uint32_t i = 0; i < vehicles; ++i) {
+            int32_t vehicle_id, count;
+            getRaw(pos, end, vehicle_id);
+            getRaw(pos, end, count);
+            store_.restoreDeliveredCount(vehicle_id, count);
+        }
+        std::cout << "[WAL] Loaded " << segments << " delivered archive segments with counts for "
+                  << vehicles << " vehicles" << std::endl;
+        return true;
+    }
+
+    void append(const Package& pkg) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        encode(pkg, pending_);
+        ++appended_;
+        ++records_since_snapshot_;
+    }
+
+    bool openSegment(uint64_t seq) {
+        fd_ = ::open(segmentPath(seq).c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+        return fd_ != -1;
+    }
+
+    static bool writeAll(int fd, const std::string& data) {
+        size_t written = 0;
+        while (written < data.size()) {
+            ssize_t n = ::write(fd, data.data() + written, data.size() - written);
+            if (n < 0) {
+                return false;
+            }
+            written += n;
+        }
+        return true;
+    }
+
+    // Writes out everything appended so far and releases the waiters it
+    // covers. Returns false if the write failed; the batch is then back in
+    // front of pending_ and no waiter is released. Only the flusher thread
+    // (or the destructor after it stopped) touches the segment file.
+    bool flush() {
+        std::string batch;
+        uint64_t upto;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batch.swap(pending_);
+            upto = appended_;
+        }
+        if (!batch.empty() && !writeBatch(batch)) {
+            std::lock_guard<std::mutex> lock(mutex_);
+            batch += pending_;
+            pending_.swap(batch);
+            return false;
+        }
+        std::vector<Waiter> released;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            durable_ = upto;
+            while (!waiters_.empty() && waiters_.front().seq <= upto) {
+                released.push_back(std::move(waiters_.front()));
+                waiters_.pop_front();
+            }
+        }
+        for (Waiter& waiter : released) {
+            waiter.done(true);
+        }
+        return true;
+    }
+
+    // Writes and syncs one batch. On failure the segment is closed, so the
+    // retry goes to a fresh one: a failed fdatasync may drop the dirty
+    // pages, so syncing this file again proves nothing. Replay of the old
+    // segment stops at any torn record, and records carry full states, so
+    // a copy that did reach the disk replays harmlessly. A segment that
+    // could not be opened is retried under the same name. Each failure
+    // episode is reported once.
+    bool writeBatch(const std::string& batch) {
+        uint64_t seq = segment_seq_;
+        if ((fd_ != -1 || openSegment(seq)) && writeAll(fd_, batch) && ::fdatasync(fd_) == 0) {
+            if (write_failing_) {
+                std::cout << "[WAL] Log writes recovered in " << segmentPath(seq) << std::endl;
+                write_failing_ = false;
+            }
+            return true;
+        }
+        if (!write_failing_) {
+            std::cerr << "[WAL] Failed to write log segment " << segmentPath(seq)
+                      << ", retrying in a new segment" << std::endl;
+            write_failing_ = true;
+        }
+        if (fd_ != -1) {
+            ::close(fd_);
+            fd_ = -1;
+            ++segment_seq_;
+        }
+        return false;
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        // Zero while the log is healthy; after a failed write, retries back
+        // off up to kMaxRetryDelay and waiters no longer cut the wait short
+        std::chrono::milliseconds retry_delay{0};
+        while (!stopping_) {
+            cv_.wait_for(lock, retry_delay.count() > 0 ? retry_delay : options_.flush_interval,
+                         [&]() { return stopping_ || (retry_delay.count() == 0 && !waiters_.empty()); });
+            bool snapshot_due = records_since_snapshot_ > 0 &&
+                std::chrono::steady_clock::now() - last_snapshot_ >= options_.snapshot_interval;
+            lock.unlock();
+            bool ok = flush() && (!snapshot_due || snapshot());
+            retry_delay = ok ? std::chrono::milliseconds(0)
+                             : std::min(std::max(2 * retry_delay, options_.flush_interval), kMaxRetryDelay);
+            lock.lock();
+        }
+    }
+
+    // Starts a new segment, dumps the store next to it and drops the
+    // segments and snapshots the new one supersedes. Returns false only if
+    // the log could not be flushed first; a failed dump is retried at the
+    // next interval.
+    bool snapshot() {
+        if (!flush()) {
+            return false;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            records_since_snapshot_ = 0;
+        }
+        if (fd_ != -1) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+        uint64_t seq = ++segment_seq_;
+        openSegment(seq);
+        last_snapshot_ = std::chrono::steady_clock::now();
+
+        std::string tmp_path = snapshotPath(seq) + ".tmp";
+        int fd = ::open(tmp_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            std::cerr << "[WAL] Failed to create snapshot " << tmp_path << std::endl;
+            return true;
+        }
+        std::string buffer(kSnapshotMagic, sizeof(kSnapshotMagic));
+        bool ok = true;
+        size_t count = 0;
+        // The counts are taken from the very slots written, so the two agree
+        std::unordered_map<int32_t, int32_t> delivered;
+        store_.forEachArchiveSegment([&](uint32_t index, const std::vector<int32_t>& slots) {
+            for (int32_t vehicle_id : slots) {
+                if (vehicle_id != DeliveredArchive::kEmpty) {
+                    ++delivered[vehicle_id];
+                }
+            }
+            encodeArchiveSegment(index, slots, buffer);
+            if (buffer.size() >= (1 << 20)) {
+                ok = ok && writeAll(fd, buffer);
+                buffer.clear();
+            }
+        });
+        encodeDeliveredCounts(delivered, buffer);
+        // No store lock is held while writing, so ingest is not stalled on the disk
+        store_.forEachLiveCopied([&](const Package& pkg) {
+            encode(pkg, buffer);
+            ++count;
+            if (buffer.size() >= (1 << 20)) {
+                ok = ok && writeAll(fd, buffer);
+                buffer.clear();
+            }
+        });
+        ok = ok && writeAll(fd, buffer) && ::fsync(fd) == 0;
+        ::close(fd);
+        if (!ok || std::rename(tmp_path.c_str(), snapshotPath(seq).c_str()) != 0) {
+            std::cerr << "[WAL] Failed to write snapshot " << snapshotPath(seq) << std::endl;
+            std::remove(tmp_path.c_str());
+            return true;
+        }
+
+        for (const auto& entry : std::filesystem::directory_iterator(options_.dir)) {
+            uint64_t old_seq;
+            std::string name = entry.path().filename().string();
+            if ((parseName(name, "snapshot-", ".bin", old_seq) || parseName(name, "wal-", ".log", old_seq)) &&
+                old_seq < seq) {
+                std::filesystem::remove(entry.path());
+            }
+        }
+        std::cout << "[WAL] Wrote snapshot of " << count << " live packages to " << snapshotPath(seq) << std::endl;
+        return true;
+    }
+
+    Options options_;
+    PackageStore& store_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    struct Waiter {
+        uint64_t seq;
+        std::function<void(bool)> done;
+    };
+
+    std::string pending_;
+    uint64_t appended_ = 0;
+    uint64_t durable_ = 0;
+    std::deque<Waiter> waiters_;
+    size_t records_since_snapshot_ = 0;
+    bool stopping_ = false;
+
+    // Segment state, flusher thread only
+    int fd_ = -1;
+    uint64_t segment_seq_ = 1;
+    bool write_failing_ = false;
+    std::chrono::steady_clock::time_point last_snapshot_;
+    std::thread flusher_;
+};
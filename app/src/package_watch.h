@@ -0,0 +1,124 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "package_store.h"
+
+// Receives status changes of the packages it subscribed to.
+// onPackageChanged is called with store and hub locks held, so it must
+// only queue the change and return. onChangesQueued follows on the same
+// thread once those locks are released; that is where I/O may start.
+class PackageWatcher {
+public:
+    virtual ~PackageWatcher() = default;
+    virtual void onPackageChanged(const Package& pkg) = 0;
+    virtual void onChangesQueued() = 0;
+
+    // A watcher may only be destroyed after unsubscribing from every
+    // package and then waiting here for deliveries already under way.
+    void waitForDeliveries() const {
+        while (pins_.load(std::memory_order_acquire) != 0) {
+            std::this_thread::yield();
+        }
+    }
+
+private:
+    friend class PackageWatchHub;
+    std::atomic<int> pins_{0};
+};
+
+// Fans store status changes out to the watchers subscribed to each
+// package id. Subscriptions are lock-striped by package id like the store.
+// After unsubscribe() returns, the watcher gets no further
+// onPackageChanged calls. Whoever changes the store calls deliver() once
+// its store call has returned, which runs onChangesQueued for the
+// watchers notified on that thread.
+class PackageWatchHub : public PackageObserver {
+public:
+    static constexpr size_t kShards = 64;
+
+    void subscribe(int32_t package_id, PackageWatcher* watcher) {
+        Shard& shard = shardFor(package_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.watchers[package_id].push_back(watcher);
+        subscriptions_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void unsubscribe(int32_t package_id, PackageWatcher* watcher) {
+        Shard& shard = shardFor(package_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.watchers.find(package_id);
+        if (it == shard.watchers.end()) {
+            return;
+        }
+        auto& list = it->second;
+        auto pos = std::find(list.begin(), list.end(), watcher);
+        if (pos == list.end()) {
+            return;
+        }
+        list.erase(pos);
+        if (list.empty()) {
+            shard.watchers.erase(it);
+        }
+        subscriptions_.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // A package cannot be watched before its id is handed out
+    void onCreated(const Package&) override {}
+
+    void onStatusChanged(const Package& pkg) override {
+        if (subscriptions_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        Shard& shard = shardFor(pkg.package_id);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.watchers.find(pkg.package_id);
+        if (it == shard.watchers.end()) {
+            return;
+        }
+        for (PackageWatcher* watcher : it->second) {
+            watcher->onPackageChanged(pkg);
+            watcher->pins_.fetch_add(1, std::memory_order_relaxed);
+            notified().push_back(watcher);
+        }
+    }
+
+    void deliver() {
+        std::vector<PackageWatcher*>& pending = notified();
+        if (pending.empty()) {
+            return;
+        }
+        std::vector<PackageWatcher*> watchers;
+        watchers.swap(pending);
+        for (PackageWatcher* watcher : watchers) {
+            watcher->onChangesQueued();
+            watcher->pins_.fetch_sub(1, std::memory_order_release);
+        }
+    }
+
+private:
+    struct Shard {
+        std::mutex mutex;
+        std::unordered_map<int32_t, std::vector<PackageWatcher*>> watchers;
+    };
+
+    // Watchers notified on this thread and not yet delivered to
+    static std::vector<PackageWatcher*>& notified() {
+        thread_local std::vector<PackageWatcher*> watchers;
+        return watchers;
+    }
+
+    Shard& shardFor(int32_t package_id) {
+        return shards_[static_cast<uint32_t>(package_id) % kShards];
+    }
+
+    std::array<Shard, kShards> shards_;
+    std::atomic<size_t> subscriptions_{0};
+};
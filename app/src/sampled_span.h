@@ -0,0 +1,95 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+#include "opentelemetry/trace/provider.h"
+#include "opentelemetry/trace/tracer.h"
+#include "telemetry.h"
+
+// Span for per-item work on ingest paths, where the sampler drops most
+// spans. It starts with only the vehicle id, which the sampler needs for
+// its per-vehicle limit; annotate() runs only on recording spans, so a
+// dropped span never builds attribute strings or events. Work that was
+// not sampled but failed or ran past TRACE_SLOW_MS (default 500) is still
+// reported: end() records a span covering it that the sampler always keeps.
+class SampledSpan {
+public:
+    SampledSpan(opentelemetry::trace::Tracer& tracer, const char* name, int32_t vehicle_id)
+        : tracer_(tracer), name_(name), vehicle_id_(vehicle_id),
+          start_system_(std::chrono::system_clock::now()), start_steady_(std::chrono::steady_clock::now()),
+          span_(tracer.StartSpan(name, {{kVehicleIdAttribute, vehicle_id}})) {}
+
+    ~SampledSpan() { end(); }
+
+    SampledSpan(const SampledSpan&) = delete;
+    SampledSpan& operator=(const SampledSpan&) = delete;
+
+    bool recording() const { return span_->IsRecording(); }
+
+    opentelemetry::trace::SpanContext context() const { return span_->GetContext(); }
+
+    // Runs fn(Span&) if the span is being recorded.
+    template <typename Fn>
+    void annotate(Fn&& fn) {
+        if (span_->IsRecording()) {
+            fn(*span_);
+        }
+    }
+
+    void fail(std::string message) {
+        failed_ = true;
+        error_ = std::move(message);
+    }
+
+    void end() {
+        if (ended_) {
+            return;
+        }
+        ended_ = true;
+        if (span_->IsRecording()) {
+            if (failed_) {
+                span_->SetStatus(opentelemetry::trace::StatusCode::kError, error_);
+            }
+            span_->End();
+            return;
+        }
+        span_->End();
+        if (!failed_ && std::chrono::steady_clock::now() - start_steady_ < slowThreshold()) {
+            return;
+        }
+        opentelemetry::trace::StartSpanOptions options;
+        options.start_system_time = opentelemetry::common::SystemTimestamp(start_system_);
+        options.start_steady_time = opentelemetry::common::SteadyTimestamp(start_steady_);
+        auto kept = tracer_.StartSpan(name_, {{kVehicleIdAttribute, vehicle_id_}, {kSamplingPriorityAttribute, 1}}, options);
+        if (failed_) {
+            kept->SetStatus(opentelemetry::trace::StatusCode::kError, error_);
+        } else {
+            kept->SetAttribute("slow", true);
+        }
+        kept->End();
+    }
+
+private:
+    static std::chrono::milliseconds slowThreshold() {
+        static const std::chrono::milliseconds threshold = []() {
+            const char* value = std::getenv("TRACE_SLOW_MS");
+            return std::chrono::milliseconds(value ? std::max(0L, std::atol(value)) : 500);
+        }();
+        return threshold;
+    }
+
+    opentelemetry::trace::Tracer& tracer_;
+    const char* name_;
+    int32_t vehicle_id_;
+    std::chrono::system_clock::time_point start_system_;
+    std::chrono::steady_clock::time_point start_steady_;
+    opentelemetry::nostd::shared_ptr<opentelemetry::trace::Span> span_;
+    bool failed_ = false;
+    bool ended_ = false;
+    std::string error_;
+};
@@ -0,0 +1,108 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include <grpcpp/support/status.h>
+
+// Asynchronous read-through cache for an upstream lookup. Concurrent
+// lookups of one key share a single upstream call, and successful results
+// are served from memory for `ttl`. Failures are not cached. Callbacks
+// run outside the cache lock, on whichever thread completed the lookup.
+// The shared call serves every waiter, so `fetch` should bound it with
+// its own timeout rather than the first caller's deadline. Entries that
+// expired with nobody waiting are pruned as the map grows.
+template <typename Key, typename Value>
+class SingleflightCache {
+public:
+    using Callback = std::function<void(const grpc::Status&, const Value&)>;
+    using Fetch = std::function<void(const Key&, Callback)>;
+
+    explicit SingleflightCache(std::chrono::milliseconds ttl) : ttl_(ttl) {}
+
+    // Runs `done` with a fresh cached value, or queues it behind the call in
+    // flight for `key`, or starts one with `fetch`.
+    void get(const Key& key, Callback done, const Fetch& fetch) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            auto now = std::chrono::steady_clock::now();
+            if (entries_.size() >= prune_at_) {
+                pruneLocked(now);
+            }
+            Entry& entry = entries_[key];
+            if (entry.cached && now < entry.expires) {
+                Value value = entry.value;
+                lock.unlock();
+                done(grpc::Status::OK, value);
+                return;
+            }
+            entry.waiters.push_back(std::move(done));
+            if (entry.in_flight) {
+                return;
+            }
+            entry.in_flight = true;
+        }
+        fetch(key, [this, key](const grpc::Status& status, const Value& value) { complete(key, status, value); });
+    }
+
+    size_t size() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return entries_.size();
+    }
+
+private:
+    static constexpr size_t kMinPruneSize = 1024;
+
+    struct Entry {
+        bool in_flight = false;
+        bool cached = false;
+        Value value{};
+        std::chrono::steady_clock::time_point expires;
+        std::vector<Callback> waiters;
+    };
+
+    void complete(const Key& key, const grpc::Status& status, const Value& value) {
+        std::vector<Callback> waiters;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = entries_.find(key);
+            waiters.swap(it->second.waiters);
+            if (status.ok() && ttl_.count() > 0) {
+                Entry& entry = it->second;
+                entry.in_flight = false;
+                entry.cached = true;
+                entry.value = value;
+                entry.expires = std::chrono::steady_clock::now() + ttl_;
+            } else {
+                // Nothing to keep, and later lookups start a new call anyway
+                entries_.erase(it);
+            }
+        }
+        for (auto& waiter : waiters) {
+            waiter(status, value);
+        }
+    }
+
+    // Drops idle entries whose value expired, then waits for the map to
+    // double before sweeping again, so pruning stays amortized O(1).
+    void pruneLocked(std::chrono::steady_clock::time_point now) {
+        for (auto it = entries_.begin(); it != entries_.end();) {
+            if (!it->second.in_flight && now >= it->second.expires) {
+                it = entries_.erase(it);
+            } else {
+                ++it;
+            }
+        }
+        prune_at_ = std::max(kMinPruneSize, 2 * entries_.size());
+    }
+
+    std::chrono::milliseconds ttl_;
+    std::mutex mutex_;
+    std::unordered_map<Key, Entry> entries_;
+    size_t prune_at_ = kMinPruneSize;
+};
@@ -0,0 +1,289 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+struct GeoPoint {
+    double latitude;
+    double longitude;
+};
+
+// Uniform latitude/longitude grid of points keyed by id. Each cell keeps
+// its points as parallel arrays, and an id index allows O(1) removal.
+// Distances are equirectangular, in degrees of latitude, which is accurate
+// enough at city scale. Not synchronized.
+class SpatialGrid {
+public:
+    explicit SpatialGrid(double cell_degrees = 0.01) : cell_degrees_(cell_degrees) {}
+
+    // Inserts the point, or moves it if the id is already present.
+    void insert(int32_t id, GeoPoint point) {
+        uint64_t key = cellKey(point);
+        auto it = slots_.find(id);
+        if (it != slots_.end()) {
+            if (it->second.key == key) {
+                Cell& cell = cells_[key];
+                cell.latitudes[it->second.index] = point.latitude;
+                cell.longitudes[it->second.index] = point.longitude;
+                return;
+            }
+            erase(it);
+        }
+        Cell& cell = cells_[key];
+        slots_[id] = Slot{key, cell.ids.size()};
+        cell.ids.push_back(id);
+        cell.latitudes.push_back(point.latitude);
+        cell.longitudes.push_back(point.longitude);
+        extendBounds(key);
+    }
+
+    bool remove(int32_t id) {
+        auto it = slots_.find(id);
+        if (it == slots_.end()) {
+            return false;
+        }
+        erase(it);
+        return true;
+    }
+
+    // Closest point to `origin`, searching rings of cells outwards until no
+    // unvisited cell can hold anything closer.
+    std::optional<std::pair<int32_t, GeoPoint>> nearest(GeoPoint origin) const {
+        if (slots_.empty()) {
+            return std::nullopt;
+        }
+        const int32_t cx = cellCoord(origin.longitude);
+        const int32_t cy = cellCoord(origin.latitude);
+        const double lon_scale = std::cos(origin.latitude * M_PI / 180.0);
+        const int32_t max_ring = std::max({cx - min_x_, max_x_ - cx, cy - min_y_, max_y_ - cy, 0});
+
+        double best = std::numeric_limits<double>::infinity();
+        int32_t best_id = -1;
+        GeoPoint best_point{0, 0};
+        auto visit = [&](const Cell& cell) {
+            for (size_t i = 0; i < cell.ids.size(); ++i) {
+                double dy = cell.latitudes[i] - origin.latitude;
+                double dx = (cell.longitudes[i] - origin.longitude) * lon_scale;
+                double d = dx * dx + dy * dy;
+                if (d < best) {
+                    best = d;
+                    best_id = cell.ids[i];
+                    best_point = GeoPoint{cell.latitudes[i], cell.longitudes[i]};
+                }
+            }
+        };
+
+        for (int32_t r = 0; r <= max_ring; ++r) {
+            // Anything in ring r is at least (r - 1) cells away along one axis
+            double bound = std::max(0, r - 1) * cell_degrees_ * std::min(1.0, lon_scale);
+            if (best <= bound * bound) {
+                break;
+            }
+            // Once a ring has more cells than the grid holds, scanning all cells is cheaper
+            if (8 * static_cast<size_t>(r) > cells_.size()) {
+                for (const auto& entry : cells_) {
+                    visit(entry.second);
+                }
+                break;
+            }
+            forEachRingCell(cx, cy, r, visit);
+        }
+        return std::make_pair(best_id, best_point);
+    }
+
+    // Calls fn(id, point) for every point inside the box, edges included.
+    template <typename Fn>
+    void forEachInBox(GeoPoint min, GeoPoint max, Fn&& fn) const {
+        std::vector<uint8_t> inside;
+        forEachCandidateCell(min, max, [&](const Cell& cell, bool contained) {
+            const size_t n = cell.ids.size();
+            if (contained) {
+                for (size_t i = 0; i < n; ++i) {
+                    fn(cell.ids[i], GeoPoint{cell.latitudes[i], cell.longitudes[i]});
+                }
+                return;
+            }
+            // Branch-free over the cell's columns, so it vectorizes
+            inside.resize(n);
+            const double* latitudes = cell.latitudes.data();
+            const double* longitudes = cell.longitudes.data();
+            for (size_t i = 0; i < n; ++i) {
+                inside[i] = (latitudes[i] >= min.latitude) & (latitudes[i] <= max.latitude) &
+                            (longitudes[i] >= min.longitude) & (longitudes[i] <= max.longitude);
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (inside[i]) {
+                    fn(cell.ids[i], GeoPoint{latitudes[i], longitudes[i]});
+                }
+            }
+        });
+    }
+
+    // Calls fn(id, point) for every point within `radius` of `center`, in
+    // degrees of latitude, using the same distance as nearest().
+    template <typename Fn>
+    void forEachInRadius(GeoPoint center, double radius, Fn&& fn) const {
+        const double lon_scale = std::cos(center.latitude * M_PI / 180.0);
+        const double lon_radius = lon_scale > 0 ? radius / lon_scale : 360.0;
+        const double radius2 = radius * radius;
+        std::vector<uint8_t> inside;
+        forEachCandidateCell(GeoPoint{center.latitude - radius, center.longitude - lon_radius},
+                             GeoPoint{center.latitude + radius, center.longitude + lon_radius},
+                             [&](const Cell& cell, bool) {
+            const size_t n = cell.ids.size();
+            inside.resize(n);
+            const double* latitudes = cell.latitudes.data();
+            const double* longitudes = cell.longitudes.data();
+            for (size_t i = 0; i < n; ++i) {
+                double dy = latitudes[i] - center.latitude;
+                double dx = (longitudes[i] - center.longitude) * lon_scale;
+                inside[i] = dx * dx + dy * dy <= radius2;
+            }
+            for (size_t i = 0; i < n; ++i) {
+                if (inside[i]) {
+                    fn(cell.ids[i], GeoPoint{latitudes[i], longitudes[i]});
+                }
+            }
+        });
+    }
+
+    size_t size() const { return slots_.size(); }
+
+    bool empty() const { return slots_.empty(); }
+
+private:
+    struct Cell {
+        std::vector<int32_t> ids;
+        std::vector<double> latitudes;
+        std::vector<double> longitudes;
+    };
+
+    struct Slot {
+        uint64_t key;
+        size_t index;
+    };
+
+    // Out-of-range coordinates land in the edge cells instead of overflowing the cast
+    int32_t cellCoord(double degrees) const {
+        if (std::isnan(degrees)) {
+            degrees = 0;
+        }
+        degrees = std::clamp(degrees, -360.0, 360.0);
+        return static_cast<int32_t>(std::floor(degrees / cell_degrees_));
+    }
+
+    static uint64_t packKey(int32_t x, int32_t y) {
+        return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) | static_cast<uint32_t>(y);
+    }
+
+    uint64_t cellKey(GeoPoint point) const {
+        return packKey(cellCoord(point.longitude), cellCoord(point.latitude));
+    }
+
+    void extendBounds(uint64_t key) {
+        int32_t x = static_cast<int32_t>(key >> 32);
+        int32_t y = static_cast<int32_t>(key & 0xffffffffu);
+        min_x_ = std::min(min_x_, x);
+        max_x_ = std::max(max_x_, x);
+        min_y_ = std::min(min_y_, y);
+        max_y_ = std::max(max_y_, y);
+    }
+
+    template <typename Fn>
+    void forEachRingCell(int32_t cx, int32_t cy, int32_t r, Fn&& fn) const {
+        auto visit = [&](int32_t x, int32_t y) {
+            auto it = cells_.find(packKey(x, y));
+            if (it != cells_.end()) {
+                fn(it->second);
+            }
+        };
+        if (r == 0) {
+            visit(cx, cy);
+            return;
+        }
+        for (int32_t x = cx - r; x <= cx + r; ++x) {
+            visit(x, cy - r);
+            visit(x, cy + r);
+        }
+        for (int32_t y = cy - r + 1; y <= cy + r - 1; ++y) {
+            visit(cx - r, y);
+            visit(cx + r, y);
+        }
+    }
+
+    // Calls fn(cell, contained) for every non-empty cell overlapping the
+    // box; contained cells lie wholly inside it. Looks cells up one by one
+    // unless the box spans more cells than the grid holds.
+    template <typename Fn>
+    void forEachCandidateCell(GeoPoint min, GeoPoint max, Fn&& fn) const {
+        if (slots_.empty() || !(min.latitude <= max.latitude) || !(min.longitude <= max.longitude)) {
+            return;
+        }
+        min = GeoPoint{std::max(min.latitude, -90.0), std::max(min.longitude, -180.0)};
+        max = GeoPoint{std::min(max.latitude, 90.0), std::min(max.longitude, 180.0)};
+        const int32_t x0 = std::max(cellCoord(min.longitude), min_x_);
+        const int32_t x1 = std::min(cellCoord(max.longitude), max_x_);
+        const int32_t y0 = std::max(cellCoord(min.latitude), min_y_);
+        const int32_t y1 = std::min(cellCoord(max.latitude), max_y_);
+        if (x0 > x1 || y0 > y1) {
+            return;
+        }
+        auto contained = [&](int32_t x, int32_t y) {
+            return x * cell_degrees_ >= min.longitude && (x + 1) * cell_degrees_ <= max.longitude &&
+                   y * cell_degrees_ >= min.latitude && (y + 1) * cell_degrees_ <= max.latitude;
+        };
+        if (static_cast<uint64_t>(x1 - x0 + 1) * static_cast<uint64_t>(y1 - y0 + 1) > cells_.size()) {
+            for (const auto& entry : cells_) {
+                int32_t x = static_cast<int32_t>(entry.first >> 32);
+                int32_t y = static_cast<int32_t>(entry.first & 0xffffffffu);
+                if (x >= x0 && x <= x1 && y >= y0 && y <= y1) {
+                    fn(entry.second, contained(x, y));
+                }
+            }
+            return;
+        }
+        for (int32_t x = x0; x <= x1; ++x) {
+            for (int32_t y = y0; y <= y1; ++y) {
+                auto it = cells_.find(packKey(x, y));
+                if (it != cells_.end()) {
+                    fn(it->second, contained(x, y));
+                }
+            }
+        }
+    }
+
+    void erase(std::unordered_map<int32_t, Slot>::iterator it) {
+        auto cell_it = cells_.find(it->second.key);
+        Cell& cell = cell_it->second;
+        size_t index = it->second.index;
+        size_t last = cell.ids.size() - 1;
+        if (index != last) {
+            cell.ids[index] = cell.ids[last];
+            cell.latitudes[index] = cell.latitudes[last];
+            cell.longitudes[index] = cell.longitudes[last];
+            slots_[cell.ids[index]].index = index;
+        }
+        cell.ids.pop_back();
+        cell.latitudes.pop_back();
+        cell.longitudes.pop_back();
+        if (cell.ids.empty()) {
+            cells_.erase(cell_it);
+        }
+        slots_.erase(it);
+    }
+
+    double cell_degrees_;
+    std::unordered_map<uint64_t, Cell> cells_;
+    std::unordered_map<int32_t, Slot> slots_;
+    // Bounding box of every cell ever used, caps how far nearest() searches
+    int32_t min_x_ = std::numeric_limits<int32_t>::max();
+    int32_t max_x_ = std::numeric_limits<int32_t>::min();
+    int32_t min_y_ = std::numeric_limits<int32_t>::max();
+    int32_t max_y_ = std::numeric_limits<int32_t>::min();
+};
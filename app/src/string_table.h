@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Interns strings into append-only arena chunks and hands out dense
+// 32-bit ids. Interned strings are never freed, so only intern values
+// that repeat heavily, such as sender addresses. Thread-safe.
+class StringTable {
+public:
+    uint32_t intern(std::string_view value) {
+        {
+            std::shared_lock<std::shared_mutex> lock(mutex_);
+            auto it = ids_.find(value);
+            if (it != ids_.end()) {
+                return it->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        auto it = ids_.find(value);
+        if (it != ids_.end()) {
+            return it->second;
+        }
+        std::string_view stored = store(value);
+        uint32_t id = static_cast<uint32_t>(values_.size());
+        values_.push_back(stored);
+        ids_.emplace(stored, id);
+        return id;
+    }
+
+    std::string get(uint32_t id) const {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        return std::string(values_[id]);
+    }
+
+private:
+    static constexpr size_t kChunkSize = 64 * 1024;
+
+    std::string_view store(std::string_view value) {
+        if (value.size() > kChunkSize / 4) {
+            // Oversized values get a chunk of their own
+            oversized_.push_back(std::make_unique<char[]>(value.size()));
+            std::memcpy(oversized_.back().get(), value.data(), value.size());
+            return std::string_view(oversized_.back().get(), value.size());
+        }
+        if (chunks_.empty() || chunk_used_ + value.size() > kChunkSize) {
+            chunks_.push_back(std::make_unique<char[]>(kChunkSize));
+            chunk_used_ = 0;
+        }
+        char* dest = chunks_.back().get() + chunk_used_;
+        std::memcpy(dest, value.data(), value.size());
+        chunk_used_ += value.size();
+        return std::string_view(dest, value.size());
+    }
+
+    mutable std::shared_mutex mutex_;
+    std::vector<std::unique_ptr<char[]>> chunks_;
+    std::vector<std::unique_ptr<char[]>> oversized_;
+    size_t chunk_used_ = 0;
+    std::vector<std::string_view> values_;
+    std::unordered_map<std::string_view, uint32_t> ids_;
+};
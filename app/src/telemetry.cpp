@@ -0,0 +1,281 @@
+#include "telemetry.h"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <utility>
+
+#include <grpcpp/ext/otel_plugin.h>
+#include <grpcpp/grpcpp.h>
+
+#include "opentelemetry/exporters/otlp/otlp_grpc_exporter.h"
+#include "opentelemetry/exporters/otlp/otlp_grpc_exporter_options.h"
+#include "opentelemetry/exporters/otlp/otlp_grpc_log_record_exporter_factory.h"
+#include "opentelemetry/exporters/otlp/otlp_grpc_log_record_exporter_options.h"
+#include "opentelemetry/exporters/otlp/otlp_grpc_metric_exporter_factory.h"
+#include "opentelemetry/exporters/otlp/otlp_grpc_metric_exporter_options.h"
+#include "opentelemetry/logs/provider.h"
+#include "opentelemetry/metrics/provider.h"
+#include "opentelemetry/sdk/logs/batch_log_record_processor_factory.h"
+#include "opentelemetry/sdk/logs/batch_log_record_processor_options.h"
+#include "opentelemetry/sdk/logs/logger_provider.h"
+#include "opentelemetry/sdk/metrics/aggregation/default_aggregation.h"
+#include "opentelemetry/sdk/metrics/export/periodic_exporting_metric_reader_factory.h"
+#include "opentelemetry/sdk/metrics/export/periodic_exporting_metric_reader_options.h"
+#include "opentelemetry/sdk/metrics/meter_context_factory.h"
+#include "opentelemetry/sdk/metrics/meter_provider.h"
+#include "opentelemetry/sdk/metrics/meter_provider_factory.h"
+#include "opentelemetry/sdk/metrics/view/instrument_selector_factory.h"
+#include "opentelemetry/sdk/metrics/view/meter_selector_factory.h"
+#include "opentelemetry/sdk/metrics/view/view_factory.h"
+#include "opentelemetry/sdk/resource/resource.h"
+#include "opentelemetry/sdk/trace/batch_span_processor_factory.h"
+#include "opentelemetry/sdk/trace/batch_span_processor_options.h"
+#include "opentelemetry/sdk/trace/sampler.h"
+#include "opentelemetry/sdk/trace/samplers/parent.h"
+#include "opentelemetry/sdk/trace/samplers/trace_id_ratio.h"
+#include "opentelemetry/sdk/trace/tracer_provider.h"
+#include "opentelemetry/trace/provider.h"
+
+namespace trace_sdk = opentelemetry::sdk::trace;
+namespace trace_api = opentelemetry::trace;
+namespace metrics_sdk = opentelemetry::sdk::metrics;
+namespace metrics_api = opentelemetry::metrics;
+namespace logs_sdk = opentelemetry::sdk::logs;
+namespace logs_api = opentelemetry::logs;
+namespace resource = opentelemetry::sdk::resource;
+namespace otlp = opentelemetry::exporter::otlp;
+namespace common = opentelemetry::common;
+namespace nostd = opentelemetry::nostd;
+
+namespace {
+
+std::shared_ptr<trace_sdk::TracerProvider> tracer_provider;
+std::shared_ptr<logs_sdk::LoggerProvider> logger_provider;
+std::shared_ptr<metrics_sdk::MeterProvider> meter_provider;
+
+void readSize(const char* name, size_t& value) {
+    if (const char* env = std::getenv(name)) {
+        value = std::max(1L, std::atol(env));
+    }
+}
+
+void readMillis(const char* name, std::chrono::milliseconds& value) {
+    if (const char* env = std::getenv(name)) {
+        value = std::chrono::milliseconds(std::max(1L, std::atol(env)));
+    }
+}
+
+void readBatch(const std::string& prefix, TelemetryOptions::Batch& batch) {
+    readSize((prefix + "_MAX_QUEUE_SIZE").c_str(), batch.max_queue_size);
+    readSize((prefix + "_MAX_EXPORT_BATCH_SIZE").c_str(), batch.max_export_batch_size);
+    readMillis((prefix + "_SCHEDULE_DELAY").c_str(), batch.schedule_delay);
+    // The SDK cannot export more per batch than the queue holds
+    batch.max_export_batch_size = std::min(batch.max_export_batch_size, batch.max_queue_size);
+}
+
+// Root sampler: keeps forced spans and samples other roots by trace id
+// ratio. Ingest spans, recognised by their vehicle id attribute, get their
+// own ratio and then at most one span per vehicle per interval, so the
+// per-location volume does not set the rate for RPC traces. The limit
+// is tracked in a fixed table of last-sampled times indexed by vehicle
+// id, so it costs no allocation or lock; vehicles that collide in the
+// table share a limit.
+class IngestSampler : public trace_sdk::Sampler {
+public:
+    IngestSampler(double ratio, double ingest_ratio, std::chrono::milliseconds vehicle_interval)
+        : ratio_sampler_(ratio), ingest_ratio_sampler_(ingest_ratio), vehicle_interval_ms_(vehicle_interval.count()) {
+        for (auto& slot : last_sampled_ms_) {
+            slot.store(INT64_MIN / 2, std::memory_order_relaxed);
+        }
+    }
+
+    trace_sdk::SamplingResult ShouldSample(const trace_api::SpanContext& parent_context, trace_api::TraceId trace_id,
+                                           nostd::string_view name, trace_api::SpanKind span_kind,
+                                           const common::KeyValueIterable& attributes,
+                                           const trace_api::SpanContextKeyValueIterable& links) noexcept override {
+        bool forced = false;
+        bool has_vehicle = false;
+        int64_t vehicle_id = 0;
+        attributes.ForEachKeyValue([&](nostd::string_view key, common::AttributeValue value) noexcept {
+            if (key == kSamplingPriorityAttribute) {
+                forced = true;
+            } else if (key == kVehicleIdAttribute) {
+                if (nostd::holds_alternative<int32_t>(value)) {
+                    has_vehicle = true;
+                    vehicle_id = nostd::get<int32_t>(value);
+                } else if (nostd::holds_alternative<int64_t>(value)) {
+                    has_vehicle = true;
+                    vehicle_id = nostd::get<int64_t>(value);
+                }
+            }
+            return true;
+        });
+        if (forced) {
+            return {trace_sdk::Decision::RECORD_AND_SAMPLE, nullptr, {}};
+        }
+        if (!has_vehicle) {
+            return ratio_sampler_.ShouldSample(parent_context, trace_id, name, span_kind, attributes, links);
+        }
+        auto result = ingest_ratio_sampler_.ShouldSample(parent_context, trace_id, name, span_kind, attributes, links);
+        if (result.decision != trace_sdk::Decision::DROP && !admitVehicle(vehicle_id)) {
+            return {trace_sdk::Decision::DROP, nullptr, {}};
+        }
+        return result;
+    }
+
+    nostd::string_view GetDescription() const noexcept override { return "IngestSampler"; }
+
+private:
+    static constexpr size_t kSlots = 4096;
+
+    bool admitVehicle(int64_t vehicle_id) {
+        if (vehicle_interval_ms_ <= 0) {
+            return true;
+        }
+        int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        auto& slot = last_sampled_ms_[static_cast<uint64_t>(vehicle_id) % kSlots];
+        int64_t last = slot.load(std::memory_order_relaxed);
+        return now_ms - last >= vehicle_interval_ms_ &&
+               slot.compare_exchange_strong(last, now_ms, std::memory_order_relaxed);
+    }
+
+    trace_sdk::TraceIdRatioBasedSampler ratio_sampler_;
+    trace_sdk::TraceIdRatioBasedSampler ingest_ratio_sampler_;
+    int64_t vehicle_interval_ms_;
+    std::array<std::atomic<int64_t>, kSlots> last_sampled_ms_;
+};
+
+void AddLatencyView(metrics_sdk::MeterProvider* provider, const std::string& name, const std::string& unit) {
+    auto histogram_config = std::make_shared<metrics_sdk::HistogramAggregationConfig>();
+    histogram_config->boundaries_ = {
+        0,     0.00001, 0.00005, 0.0001, 0.0003, 0.0006, 0.0008, 0.001, 0.002,
+        0.003, 0.004,   0.005,   0.006,  0.008,  0.01,   0.013,  0.016, 0.02,
+        0.025, 0.03,    0.04,    0.05,   0.065,  0.08,   0.1,    0.13,  0.16,
+        0.2,   0.25,    0.3,     0.4,    0.5,    0.65,   0.8,    1,     2,
+        5,     10,      20,      50,     100};
+    provider->AddView(
+        metrics_sdk::InstrumentSelectorFactory::Create(metrics_sdk::InstrumentType::kHistogram, name, unit),
+        metrics_sdk::MeterSelectorFactory::Create("grpc-c++", grpc::Version(), ""),
+        metrics_sdk::ViewFactory::Create(name, "", unit, metrics_sdk::AggregationType::kHistogram,
+                                         std::move(histogram_config)));
+}
+
+}  // namespace
+
+TelemetryOptions TelemetryOptions::fromEnv(std::string service_name) {
+    TelemetryOptions options;
+    options.service_name = std::move(service_name);
+    if (const char* endpoint = std::getenv("OTEL_EXPORTER_OTLP_ENDPOINT")) {
+        options.endpoint = endpoint;
+    }
+    readMillis("OTEL_EXPORTER_OTLP_TIMEOUT", options.export_timeout);
+    readBatch("OTEL_BSP", options.spans);
+    readBatch("OTEL_BLRP", options.logs);
+    readMillis("OTEL_METRIC_EXPORT_INTERVAL", options.metric_export_interval);
+    readMillis("OTEL_METRIC_EXPORT_TIMEOUT", options.metric_export_timeout);
+    if (const char* ratio = std::getenv("OTEL_TRACES_SAMPLER_ARG")) {
+        options.sample_ratio = std::clamp(std::atof(ratio), 0.0, 1.0);
+    }
+    if (const char* ratio = std::getenv("TRACE_INGEST_SAMPLE_RATIO")) {
+        options.ingest_sample_ratio = std::clamp(std::atof(ratio), 0.0, 1.0);
+    }
+    if (const char* interval_ms = std::getenv("TRACE_VEHICLE_SPAN_INTERVAL_MS")) {
+        options.vehicle_span_interval = std::chrono::milliseconds(std::max(0L, std::atol(interval_ms)));
+    }
+    return options;
+}
+
+void initTelemetry(const TelemetryOptions& options) {
+    auto resource_attributes = resource::Resource::Create({
+        {"service.name", options.service_name},
+        {"service.version", "1.0.0"},
+        {"deployment.environment", "dev"}
+    });
+
+    // Tracing
+    otlp::OtlpGrpcExporterOptions trace_opts;
+    trace_opts.endpoint = options.endpoint;
+    trace_opts.use_ssl_credentials = false;
+    trace_opts.timeout = options.export_timeout;
+    trace_sdk::BatchSpanProcessorOptions span_batch;
+    span_batch.max_queue_size = options.spans.max_queue_size;
+    span_batch.max_export_batch_size = options.spans.max_export_batch_size;
+    span_batch.schedule_delay_millis = options.spans.schedule_delay;
+    auto trace_processor = trace_sdk::BatchSpanProcessorFactory::Create(
+        std::make_unique<otlp::OtlpGrpcExporter>(trace_opts), span_batch);
+    auto sampler = std::make_unique<trace_sdk::ParentBasedSampler>(
+        std::make_shared<IngestSampler>(options.sample_ratio, options.ingest_sample_ratio,
+                                        options.vehicle_span_interval));
+    tracer_provider = std::make_shared<trace_sdk::TracerProvider>(std::move(trace_processor), resource_attributes,
+                                                                   std::move(sampler));
+    trace_api::Provider::SetTracerProvider(std::shared_ptr<trace_api::TracerProvider>(tracer_provider));
+
+    // Logging
+    otlp::OtlpGrpcLogRecordExporterOptions log_opts;
+    log_opts.endpoint = options.endpoint;
+    log_opts.use_ssl_credentials = false;
+    log_opts.timeout = options.export_timeout;
+    logs_sdk::BatchLogRecordProcessorOptions log_batch;
+    log_batch.max_queue_size = options.logs.max_queue_size;
+    log_batch.max_export_batch_size = options.logs.max_export_batch_size;
+    log_batch.schedule_delay_millis = options.logs.schedule_delay;
+    auto log_processor = logs_sdk::BatchLogRecordProcessorFactory::Create(
+        otlp::OtlpGrpcLogRecordExporterFactory::Create(log_opts), log_batch);
+    logger_provider = std::make_shared<logs_sdk::LoggerProvider>(std::move(log_processor), resource_attributes);
+    logs_api::Provider::SetLoggerProvider(std::shared_ptr<logs_api::LoggerProvider>(logger_provider));
+
+    // Metrics are collected and exported by the reader's own thread
+    otlp::OtlpGrpcMetricExporterOptions metric_opts;
+    metric_opts.endpoint = options.endpoint;
+    metric_opts.use_ssl_credentials = false;
+    metrics_sdk::PeriodicExportingMetricReaderOptions reader_options;
+    reader_options.export_interval_millis = options.metric_export_interval;
+    reader_options.export_timeout_millis = std::min(options.metric_export_timeout, options.metric_export_interval);
+    auto reader = metrics_sdk::PeriodicExportingMetricReaderFactory::Create(
+        otlp::OtlpGrpcMetricExporterFactory::Create(metric_opts), reader_options);
+    auto context = metrics_sdk::MeterContextFactory::Create();
+    context->AddMetricReader(std::move(reader));
+    meter_provider = metrics_sdk::MeterProviderFactory::Create(std::move(context));
+    AddLatencyView(meter_provider.get(), "grpc.server.call.duration", "s");
+    AddLatencyView(meter_provider.get(), "grpc.client.attempt.duration", "s");
+    metrics_api::Provider::SetMeterProvider(std::shared_ptr<metrics_api::MeterProvider>(meter_provider));
+
+    // Per-method call duration, call counts and message sizes for every
+    // server and channel built after this point. The exporters' own
+    // channels already exist, so exports are not measured.
+    auto status = grpc::OpenTelemetryPluginBuilder()
+                      .SetMeterProvider(std::shared_ptr<metrics_api::MeterProvider>(meter_provider))
+                      .EnableMetrics({grpc::OpenTelemetryPluginBuilder::kClientAttemptStartedInstrumentName,
+                                      grpc::OpenTelemetryPluginBuilder::kClientAttemptDurationInstrumentName,
+                                      grpc::OpenTelemetryPluginBuilder::kClientAttemptSentTotalCompressedMessageSizeInstrumentName,
+                                      grpc::OpenTelemetryPluginBuilder::kClientAttemptRcvdTotalCompressedMessageSizeInstrumentName,
+                                      grpc::OpenTelemetryPluginBuilder::kServerCallStartedInstrumentName,
+                                      grpc::OpenTelemetryPluginBuilder::kServerCallDurationInstrumentName,
+                                      grpc::OpenTelemetryPluginBuilder::kServerCallSentTotalCompressedMessageSizeInstrumentName,
+                                      grpc::OpenTelemetryPluginBuilder::kServerCallRcvdTotalCompressedMessageSizeInstrumentName})
+                      .BuildAndRegisterGlobal();
+    if (!status.ok()) {
+        std::cerr << "[TELEMETRY] gRPC metrics disabled: " << status.ToString() << std::endl;
+    }
+}
+
+void shutdownTelemetry() {
+    if (tracer_provider) {
+        tracer_provider->ForceFlush();
+        tracer_provider->Shutdown();
+    }
+    if (logger_provider) {
+        logger_provider->ForceFlush();
+        logger_provider->Shutdown();
+    }
+    if (meter_provider) {
+        meter_provider->ForceFlush();
+        meter_provider->Shutdown();
+    }
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+// Span attributes the sampler looks at when a span starts: vehicle_id
+// for the per-vehicle limit, and sampling.priority to keep a span
+// regardless of ratio and limits.
+inline constexpr const char* kVehicleIdAttribute = "vehicle_id";
+inline constexpr const char* kSamplingPriorityAttribute = "sampling.priority";
+
+// OTLP export setup shared by the servers. Spans and log records go into
+// bounded in-memory queues that background threads export in batches, so
+// ending a span or emitting a log never waits on the collector; when a
+// queue is full new records are dropped instead of blocking the caller.
+struct TelemetryOptions {
+    struct Batch {
+        size_t max_queue_size = 2048;
+        size_t max_export_batch_size = 512;
+        std::chrono::milliseconds schedule_delay{1000};
+    };
+
+    std::string service_name;
+    std::string endpoint = "simplest-collector:4317";
+    std::chrono::milliseconds export_timeout{10000};
+    Batch spans;
+    Batch logs;
+    std::chrono::milliseconds metric_export_interval{1000};
+    std::chrono::milliseconds metric_export_timeout{500};
+
+    // Root spans are kept with sample_ratio and children follow their
+    // parent. Ingest spans, the ones started with a vehicle id, are kept
+    // with ingest_sample_ratio instead and further limited to one per
+    // vehicle per interval (0 disables the limit).
+    double sample_ratio = 1.0;
+    double ingest_sample_ratio = 0.1;
+    std::chrono::milliseconds vehicle_span_interval{10000};
+
+    // Reads the standard OTel variables: OTEL_EXPORTER_OTLP_ENDPOINT,
+    // OTEL_EXPORTER_OTLP_TIMEOUT, OTEL_BSP_* for spans, OTEL_BLRP_* for
+    // logs (MAX_QUEUE_SIZE, MAX_EXPORT_BATCH_SIZE, SCHEDULE_DELAY) and
+    // OTEL_METRIC_EXPORT_INTERVAL / OTEL_METRIC_EXPORT_TIMEOUT, plus
+    // OTEL_TRACES_SAMPLER_ARG for the root ratio, TRACE_INGEST_SAMPLE_RATIO
+    // and TRACE_VEHICLE_SPAN_INTERVAL_MS.
+    static TelemetryOptions fromEnv(std::string service_name);
+};
+
+// Installs the global tracer, meter and logger providers and registers
+// the gRPC metrics plugin. Call it before creating servers or channels:
+// only those built afterwards report per-RPC metrics.
+void initTelemetry(const TelemetryOptions& options);
+
+// Exports whatever is still queued and stops the exporters.
+void shutdownTelemetry();
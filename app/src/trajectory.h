@@ -0,0 +1,97 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <queue>
+#include <vector>
+
+#include "location_history.h"
+
+// Reduces a trajectory to at most `max_points` points (at least the two
+// endpoints), keeping its shape. Douglas–Peucker refined best-first:
+// each step keeps the point farthest from the current simplified line,
+// so stopping at any count leaves the most significant points. Stops
+// early once no point deviates by more than `tolerance_degrees`.
+inline std::vector<LocationPoint> simplifyTrajectory(const std::vector<LocationPoint>& points, size_t max_points,
+                                                     double tolerance_degrees = 0) {
+    const size_t n = points.size();
+    if (n <= std::max<size_t>(max_points, 2)) {
+        return points;
+    }
+    max_points = std::max<size_t>(max_points, 2);
+
+    // Equirectangular projection, longitudes scaled at the mean latitude
+    double mean_latitude = 0;
+    for (const LocationPoint& point : points) {
+        mean_latitude += point.latitude;
+    }
+    const double lon_scale = std::cos(mean_latitude / n * M_PI / 180.0);
+
+    struct Span {
+        size_t first;
+        size_t last;
+        size_t farthest;
+        double distance;
+
+        bool operator<(const Span& other) const { return distance < other.distance; }
+    };
+
+    auto measure = [&](size_t first, size_t last) {
+        Span span{first, last, first, -1};
+        const double ax = points[first].longitude * lon_scale;
+        const double ay = points[first].latitude;
+        const double dx = points[last].longitude * lon_scale - ax;
+        const double dy = points[last].latitude - ay;
+        const double length2 = dx * dx + dy * dy;
+        for (size_t i = first + 1; i < last; ++i) {
+            double px = points[i].longitude * lon_scale - ax;
+            double py = points[i].latitude - ay;
+            double d2;
+            if (length2 == 0) {
+                d2 = px * px + py * py;
+            } else {
+                double t = std::clamp((px * dx + py * dy) / length2, 0.0, 1.0);
+                double ex = px - t * dx;
+                double ey = py - t * dy;
+                d2 = ex * ex + ey * ey;
+            }
+            if (d2 > span.distance) {
+                span.distance = d2;
+                span.farthest = i;
+            }
+        }
+        return span;
+    };
+
+    std::vector<bool> keep(n, false);
+    keep.front() = keep.back() = true;
+    size_t kept = 2;
+    std::priority_queue<Span> spans;
+    spans.push(measure(0, n - 1));
+    const double tolerance2 = tolerance_degrees * tolerance_degrees;
+    while (kept < max_points && !spans.empty()) {
+        Span span = spans.top();
+        spans.pop();
+        if (span.distance <= tolerance2) {
+            break;
+        }
+        keep[span.farthest] = true;
+        ++kept;
+        if (span.farthest - span.first > 1) {
+            spans.push(measure(span.first, span.farthest));
+        }
+        if (span.last - span.farthest > 1) {
+            spans.push(measure(span.farthest, span.last));
+        }
+    }
+
+    std::vector<LocationPoint> simplified;
+    simplified.reserve(kept);
+    for (size_t i = 0; i < n; ++i) {
+        if (keep[i]) {
+            simplified.push_back(points[i]);
+        }
+    }
+    return simplified;
+}
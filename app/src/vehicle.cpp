@@ -6,12 +6,15 @@
 #include <random>
 #include <chrono>
 #include <cstdlib>
+#include <cmath>
 
 #include <condition_variable>
 #include <grpcpp/grpcpp.h>
 #include <grpc/grpc.h>
 #include "vehicle_service.grpc.pb.h"
 #include "package_service.grpc.pb.h"
+#include "location_codec.h"
+#include "telemetry.h"
 
 using grpc::Channel;
 using grpc::ClientContext;
@@ -28,10 +31,22 @@ public:
     VehicleClient(std::shared_ptr<ChannelInterface> vehicle_channel,
                   std::shared_ptr<ChannelInterface> package_channel)
     : vehicle_stub_(VehicleService::NewStub(vehicle_channel)),
-    package_stub_(PackageService::NewStub(package_channel)) {}
+    package_stub_(PackageService::NewStub(package_channel)) {
+        std::default_random_engine rng(std::random_device{}());
+        latitude_ = std::uniform_real_distribution<double>(50.0, 52.0)(rng);
+        longitude_ = std::uniform_real_distribution<double>(18.0, 20.0)(rng);
+    }
 
     void Start(int vehicle_id) {
-        std::thread loc_thread(&VehicleClient::SendLocations, this, vehicle_id);
+        // VEHICLE_BATCH_SIZE > 1 uploads fixes through sendLocations, flushing every
+        // VEHICLE_BATCH_SIZE fixes or VEHICLE_BATCH_INTERVAL_MS, whichever comes first
+        const char* batch_env = std::getenv("VEHICLE_BATCH_SIZE");
+        const char* interval_env = std::getenv("VEHICLE_BATCH_INTERVAL_MS");
+        batch_size_ = batch_env ? std::max(1, std::atoi(batch_env)) : 1;
+        batch_interval_ = std::chrono::milliseconds(interval_env ? std::max(0, std::atoi(interval_env)) : 10000);
+
+        std::thread loc_thread(batch_size_ > 1 ? &VehicleClient::SendLocationBatches : &VehicleClient::SendLocations,
+                               this, vehicle_id);
         std::thread pkg_thread(&VehicleClient::UpdatePackages, this, vehicle_id);
 
         loc_thread.join();
@@ -44,20 +59,39 @@ private:
 
     std::mutex packages_mutex_;
 
+    // Where the vehicle is now, it moves to each package's destination on delivery
+    std::mutex position_mutex_;
+    double latitude_;
+    double longitude_;
+
+    int batch_size_ = 1;
+    std::chrono::milliseconds batch_interval_{10000};
+
+    // Drifts the vehicle a little, as if it moved since the last fix
+    LocationPoint NextFix(std::default_random_engine& rng) {
+        std::uniform_real_distribution<double> drift(-0.002, 0.002);
+        std::lock_guard<std::mutex> lock(position_mutex_);
+        latitude_ += drift(rng);
+        longitude_ += drift(rng);
+        int64_t now_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+        return LocationPoint{now_ms, latitude_, longitude_};
+    }
+
     void SendLocations(int vehicle_id) {
         ClientContext context;
         Ack ack;
         auto writer = vehicle_stub_->sendLocation(&context, &ack);
 
         std::default_random_engine rng(std::random_device{}());
-        std::uniform_real_distribution<double> lat_dist(50.0, 52.0);
-        std::uniform_real_distribution<double> lon_dist(18.0, 20.0);
 
         while (true) {
+            LocationPoint fix = NextFix(rng);
             Location loc;
             loc.set_vehicle_id(vehicle_id);
-            loc.set_latitude(lat_dist(rng));
-            loc.set_longitude(lon_dist(rng));
+            loc.set_latitude(fix.latitude);
+            loc.set_longitude(fix.longitude);
+            loc.set_timestamp_ms(fix.timestamp_ms);
 
             std::cout << "[GPS] Sending location: " << loc.latitude() << ", " << loc.longitude() << std::endl;
 
@@ -77,6 +111,55 @@ private:
         }
     }
 
+    void SendLocationBatches(int vehicle_id) {
+        ClientContext context;
+        Ack ack;
+        auto writer = vehicle_stub_->sendLocations(&context, &ack);
+
+        std::default_random_engine rng(std::random_device{}());
+        std::vector<LocationPoint> fixes;
+        LocationBatch batch;
+        auto window_start = std::chrono::steady_clock::now();
+
+        while (true) {
+            fixes.push_back(NextFix(rng));
+
+            if (static_cast<int>(fixes.size()) >= batch_size_ ||
+                std::chrono::steady_clock::now() - window_start >= batch_interval_) {
+                encodeLocations(vehicle_id, fixes, &batch);
+                if (!writer->Write(batch)) {
+                    std::cerr << "[!] Failed to write location batch to stream." << std::endl;
+                    break;
+                }
+                std::cout << "[CLIENT] Wrote " << fixes.size() << " locations (" << batch.ByteSizeLong()
+                << " bytes) for vehicle_id=" << vehicle_id << std::endl;
+                fixes.clear();
+                window_start = std::chrono::steady_clock::now();
+            }
+
+            std::this_thread::sleep_for(std::chrono::seconds(2));
+        }
+
+        writer->WritesDone();
+        Status status = writer->Finish();
+        if (!status.ok()) {
+            std::cerr << "[!] Location stream failed: " << status.error_message() << std::endl;
+        }
+    }
+
+    void SetPosition(GeoPoint* position) {
+        std::lock_guard<std::mutex> lock(position_mutex_);
+        position->set_latitude(latitude_);
+        position->set_longitude(longitude_);
+    }
+
+    double DistanceKm(const GeoPoint& to) {
+        std::lock_guard<std::mutex> lock(position_mutex_);
+        double dy = (to.latitude() - latitude_) * 110.57;
+        double dx = (to.longitude() - longitude_) * 111.32 * std::cos(latitude_ * M_PI / 180.0);
+        return std::sqrt(dx * dx + dy * dy);
+    }
+
     void UpdatePackages(int vehicle_id) {
         ClientContext context;
         auto stream = package_stub_->updatePackages(&context);
@@ -86,6 +169,7 @@ private:
         dummy.set_vehicle_id(vehicle_id);
         dummy.set_status(PackageStatus::DELIVERED); // Pretend we just delivered one
         dummy.set_package_id(-1); // Dummy ID
+        SetPosition(dummy.mutable_position());
         stream->Write(dummy);
 
         PackageInstruction instr;
@@ -100,13 +184,25 @@ private:
             std::cout << "[CLIENT] Received package " << pkg_id << " to deliver at: " << address << std::endl;
 
             int delay = delay_dist(rng);
+            if (instr.has_destination()) {
+                // Roughly 1 second per 2 km, as the crow flies
+                double km = DistanceKm(instr.destination());
+                delay = std::clamp(static_cast<int>(km / 2.0), 1, 10);
+            }
             std::cout << "[CLIENT] Delivering in " << delay << " seconds...\n";
             std::this_thread::sleep_for(std::chrono::seconds(delay));
 
+            if (instr.has_destination()) {
+                std::lock_guard<std::mutex> lock(position_mutex_);
+                latitude_ = instr.destination().latitude();
+                longitude_ = instr.destination().longitude();
+            }
+
             PackageUpdate update;
             update.set_vehicle_id(vehicle_id);
             update.set_package_id(pkg_id);
             update.set_status(PackageStatus::DELIVERED);
+            SetPosition(update.mutable_position());
 
             if (!stream->Write(update)) {
                 std::cerr << "[!] Failed to send update for package " << pkg_id << std::endl;
@@ -141,6 +237,7 @@ int main(int argc, char** argv) {
 
     std::cout << "[INFO] Vehicle client started with vehicle_id = " << vehicle_id << "\n";
 
+    initTelemetry(TelemetryOptions::fromEnv("vehicle-client"));
     std::string vehicle_addr = "vehicle-service:50052";
     std::string package_addr = "package-service:50052";
 
@@ -150,6 +247,7 @@ int main(int argc, char** argv) {
     );
 
     client.Start(vehicle_id);
+    shutdownTelemetry();
 
     return 0;
 }
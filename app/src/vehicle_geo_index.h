@@ -0,0 +1,101 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "spatial_grid.h"
+#include "vehicle_table.h"
+
+// Latest vehicle positions in a grid for area queries. Ingest does not
+// touch the index: each vehicle's latest point already sits in its own
+// seqlock slot in the VehicleTable, and a background thread folds the
+// slots whose version changed into the grid every refresh interval. A
+// query therefore sees positions at most one interval old, and location
+// updates for different vehicles never share a lock here.
+class VehicleGeoIndex {
+public:
+    VehicleGeoIndex(const VehicleTable& vehicles, std::chrono::milliseconds refresh)
+        : vehicles_(vehicles), refresh_interval_(refresh), thread_([this]() { run(); }) {}
+
+    ~VehicleGeoIndex() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        cv_.notify_one();
+        thread_.join();
+    }
+
+    // Calls fn(vehicle_id, position) for every vehicle inside the box.
+    template <typename Fn>
+    void forEachInBox(GeoPoint min, GeoPoint max, Fn&& fn) const {
+        std::shared_lock<std::shared_mutex> lock(grid_mutex_);
+        grid_.forEachInBox(min, max, fn);
+    }
+
+    // Calls fn(vehicle_id, position) for every vehicle within `radius_km`.
+    template <typename Fn>
+    void forEachInRadius(GeoPoint center, double radius_km, Fn&& fn) const {
+        std::shared_lock<std::shared_mutex> lock(grid_mutex_);
+        grid_.forEachInRadius(center, radius_km / kKmPerDegreeLatitude, fn);
+    }
+
+private:
+    static constexpr double kKmPerDegreeLatitude = 110.57;
+
+    // Applies the positions that changed since the last refresh. Only this
+    // thread writes the grid; the slots are read before taking its lock,
+    // so queries wait only for the inserts.
+    void refresh() {
+        std::vector<std::pair<int32_t, GeoPoint>> moved;
+        vehicles_.forEach([&](int32_t vehicle_id, const VehicleState& vehicle) {
+            uint64_t& seen = versions_[vehicle_id];
+            if (!vehicle.changedSince(seen)) {
+                return;
+            }
+            if (auto point = vehicle.latest(&seen)) {
+                moved.emplace_back(vehicle_id, GeoPoint{point->latitude, point->longitude});
+            }
+        });
+        if (moved.empty()) {
+            return;
+        }
+        std::unique_lock<std::shared_mutex> lock(grid_mutex_);
+        for (const auto& [vehicle_id, position] : moved) {
+            grid_.insert(vehicle_id, position);
+        }
+    }
+
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_) {
+            cv_.wait_for(lock, refresh_interval_, [this]() { return stopping_; });
+            if (stopping_) {
+                break;
+            }
+            lock.unlock();
+            refresh();
+            lock.lock();
+        }
+    }
+
+    const VehicleTable& vehicles_;
+    std::chrono::milliseconds refresh_interval_;
+
+    mutable std::shared_mutex grid_mutex_;
+    SpatialGrid grid_;
+    // Slot version each vehicle was last indexed at; refresher thread only
+    std::unordered_map<int32_t, uint64_t> versions_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
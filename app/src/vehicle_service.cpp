@@ -4,9 +4,10 @@
 #include <vector>
 #include <mutex>
 #include <thread>
-#include <condition_variable>
 #include <unordered_map>
 #include <chrono>
+#include <algorithm>
+#include <deque>
 #include <cstdlib>
 
 #include <grpcpp/server.h>
@@ -16,48 +17,24 @@
 #include <grpcpp/grpcpp.h>
 #include "vehicle_service.grpc.pb.h"
 #include "package_service.grpc.pb.h"
+#include "latency_injection.h"
+#include "vehicle_table.h"
+#include "delay_scheduler.h"
+#include "location_codec.h"
+#include "singleflight_cache.h"
+#include "trajectory.h"
+#include "vehicle_geo_index.h"
+#include "location_archive.h"
+#include "fleet_feed.h"
+#include "telemetry.h"
+#include "sampled_span.h"
+#include "async_log.h"
+#include "metric_labels.h"
 
-#include <opentelemetry/exporters/otlp/otlp_grpc_exporter.h>
-#include <opentelemetry/sdk/trace/simple_processor.h>
-#include <opentelemetry/sdk/trace/tracer_provider.h>
-
-#include "opentelemetry/exporters/otlp/otlp_http_exporter_factory.h"
-#include "opentelemetry/exporters/otlp/otlp_http_exporter_options.h"
-#include "opentelemetry/sdk/trace/processor.h"
-#include "opentelemetry/sdk/trace/batch_span_processor_factory.h"
-#include "opentelemetry/sdk/trace/batch_span_processor_options.h"
-#include "opentelemetry/sdk/trace/tracer_provider_factory.h"
-#include "opentelemetry/trace/provider.h"
-#include "opentelemetry/sdk/trace/tracer_provider.h"
-
-#include "opentelemetry/exporters/otlp/otlp_http_metric_exporter_factory.h"
-#include "opentelemetry/exporters/otlp/otlp_http_metric_exporter_options.h"
-#include "opentelemetry/metrics/provider.h"
-#include "opentelemetry/sdk/metrics/aggregation/default_aggregation.h"
-#include "opentelemetry/sdk/metrics/export/periodic_exporting_metric_reader.h"
-#include "opentelemetry/sdk/metrics/export/periodic_exporting_metric_reader_factory.h"
-#include "opentelemetry/sdk/metrics/meter_context_factory.h"
-#include "opentelemetry/sdk/metrics/meter_provider.h"
-#include "opentelemetry/sdk/metrics/meter_provider_factory.h"
-
-#include "opentelemetry/exporters/otlp/otlp_http_log_record_exporter_factory.h"
-#include "opentelemetry/exporters/otlp/otlp_http_log_record_exporter_options.h"
 #include "opentelemetry/logs/provider.h"
-#include "opentelemetry/sdk/logs/logger_provider_factory.h"
-#include "opentelemetry/sdk/logs/processor.h"
-#include "opentelemetry/sdk/logs/simple_log_record_processor_factory.h"
-
-#include "opentelemetry/sdk/metrics/view/instrument_selector_factory.h"
-#include "opentelemetry/sdk/metrics/view/meter_selector_factory.h"
-#include "opentelemetry/sdk/metrics/view/view_factory.h"
-
-#include "opentelemetry/exporters/otlp/otlp_grpc_log_record_exporter_factory.h"
-#include "opentelemetry/exporters/otlp/otlp_grpc_log_record_exporter_options.h"
-#include "opentelemetry/exporters/otlp/otlp_grpc_metric_exporter_factory.h"
-#include "opentelemetry/exporters/otlp/otlp_grpc_metric_exporter_options.h"
-#include <opentelemetry/sdk/resource/resource.h>
-
+#include "opentelemetry/metrics/provider.h"
 #include "opentelemetry/metrics/sync_instruments.h"
+#include "opentelemetry/trace/provider.h"
 
 using grpc::Server;
 using grpc::ServerBuilder;
@@ -68,55 +45,301 @@ using grpc::Status;
 
 using vehicle::VehicleService;
 using vehicle::Location;
+using vehicle::LocationBatch;
 using vehicle::Ack;
 using vehicle::TrackRequest;
 using vehicle::DeliveryQuery;
 using vehicle::DeliveryCount;
+using vehicle::FleetDeliveryQuery;
+using vehicle::FleetDeliveryCounts;
+using vehicle::TrajectoryRequest;
+using vehicle::Trajectory;
+using vehicle::AreaQuery;
+using vehicle::VehiclesInArea;
+using vehicle::FleetWatchRequest;
+using vehicle::FleetFrame;
 using packages::PackageService;
 using packages::VehicleQuery;
 
-namespace trace_sdk = opentelemetry::sdk::trace;
 namespace trace_api = opentelemetry::trace;
-namespace otlp_exporter = opentelemetry::exporter::otlp;
-
-namespace metrics_sdk      = opentelemetry::sdk::metrics;
-namespace metrics_api      = opentelemetry::metrics;
-namespace resource  = opentelemetry::sdk::resource;
-
-namespace otlp = opentelemetry::exporter::otlp;
-
+namespace metrics_api = opentelemetry::metrics;
 namespace logs_api = opentelemetry::logs;
-namespace logs_sdk = opentelemetry::sdk::logs;
+
+std::chrono::milliseconds envMillis(const char* name, int fallback) {
+    const char* value = std::getenv(name);
+    return std::chrono::milliseconds(value ? std::max(0, std::atoi(value)) : fallback);
+}
 
 struct VehicleLocation {
     double latitude;
     double longitude;
 };
 
-class VehicleServiceImpl final : public VehicleService::Service {
+class VehicleServiceImpl final
+    : public VehicleService::WithCallbackMethod_watchFleet<
+          VehicleService::WithCallbackMethod_getPackagesDeliveredByFleet<
+              VehicleService::WithCallbackMethod_getPackagesDeliveredBy<
+                  VehicleService::WithCallbackMethod_trackVehicle<VehicleService::Service>>>> {
 private:
-    std::mutex mutex_;
-    std::unordered_map<int32_t, std::vector<Location>> vehicle_locations_;
+    VehicleTable vehicles_{LocationHistory::Options::fromEnv()};
+    VehicleGeoIndex geo_index_{vehicles_, envMillis("GEO_INDEX_REFRESH_MS", 100)};
+    std::unique_ptr<LocationArchive> archive_;
+    FleetFeed fleet_feed_{vehicles_, envMillis("FLEET_TICK_MS", 1000)};
+    DelayScheduler delays_;
+
+    // Delivered counts per vehicle id, shared by concurrent queries and kept for a short TTL
+    using DeliveredCountCache = SingleflightCache<int32_t, int32_t>;
+    DeliveredCountCache delivered_counts_{envMillis("VEHICLE_DELIVERED_CACHE_TTL_MS", 1000)};
+    std::chrono::milliseconds package_service_timeout_ = envMillis("PACKAGE_SERVICE_TIMEOUT_MS", 2000);
+    // How far ahead of the server clock a vehicle's timestamp may be
+    std::chrono::milliseconds max_clock_skew_ = envMillis("VEHICLE_MAX_CLOCK_SKEW_MS", 60000);
     std::unordered_map<int32_t, int32_t> delivered_packages_;
 	std::unique_ptr<PackageService::Stub> package_stub_;
 
-    struct TrackData {
-    std::mutex track_mutex;
-    std::condition_variable cv;
-    Location latest_location;
-    bool updated = false;
-};
-    std::unordered_map<int32_t, std::shared_ptr<TrackData>> tracking_data_;
+    LatencyPolicy send_location_latency_ = LatencyPolicy::fromEnv("SEND_LOCATION", LatencyPolicy::uniform(50, 200));
+    LatencyPolicy track_vehicle_latency_ = LatencyPolicy::fromEnv("TRACK_VEHICLE", LatencyPolicy::uniform(80, 250));
+    LatencyPolicy packages_delivered_latency_ = LatencyPolicy::fromEnv("GET_PACKAGES_DELIVERED_BY", LatencyPolicy::uniform(100, 300));
 
     opentelemetry::nostd::shared_ptr<trace_api::Tracer> tracer_;
     opentelemetry::nostd::shared_ptr<metrics_api::Meter> meter_;
-    opentelemetry::nostd::shared_ptr<logs_api::Logger> logger_;
 
     opentelemetry::nostd::shared_ptr<opentelemetry::metrics::Counter<double>> send_location_counter;
     opentelemetry::nostd::shared_ptr<opentelemetry::metrics::Counter<double>> track_vehicle_counter;
     opentelemetry::nostd::shared_ptr<opentelemetry::metrics::Counter<double>> get_packages_delivered_counter;
     opentelemetry::nostd::shared_ptr<opentelemetry::metrics::Counter<double>> locations_processed_counter;
     opentelemetry::nostd::shared_ptr<opentelemetry::metrics::Histogram<double>> package_service_latency_histogram;
+    VehicleLabels vehicle_labels_{VehicleLabels::limitFromEnv()};
+
+    // Streams one vehicle's live position to a tracker. It sends the
+    // current position, then the latest one after each ingested point.
+    // Points that arrive while a write is in flight are coalesced into
+    // the next write, so a slow tracker skips points instead of queueing
+    // them. No thread waits on the tracker between writes.
+    class TrackVehicleReactor : public grpc::ServerWriteReactor<Location>, public LocationWatcher {
+    public:
+        TrackVehicleReactor(VehicleServiceImpl* service, const TrackRequest& request, VehicleState* vehicle)
+            : service_(service), vehicle_(vehicle), vehicle_id_(request.vehicle_id()),
+              max_updates_(request.max_updates()), span_(service->tracer_->StartSpan("track_vehicle")) {
+            span_->SetAttribute("vehicle_id", vehicle_id_);
+            auto ctx = span_->GetContext();
+            LOG_SPAN_INFO(ctx, "[VEHICLE_SERVICE] trackVehicle called for vehicle_id=" << vehicle_id_);
+            if (!vehicle_) {
+                std::lock_guard<std::mutex> lock(mutex_);
+                finishLocked(Status(grpc::StatusCode::NOT_FOUND, "Vehicle has not reported a location"));
+                return;
+            }
+            vehicle_->subscribe(this);
+            onLocationUpdated();
+        }
+
+        void onLocationUpdated() override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (finished_) {
+                return;
+            }
+            if (writing_) {
+                dirty_ = true;
+                return;
+            }
+            startWriteLocked();
+        }
+
+        void OnWriteDone(bool ok) override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            writing_ = false;
+            if (!ok) {
+                finishLocked(Status::CANCELLED);
+                return;
+            }
+            if (finished_) {
+                return;
+            }
+            if (span_->IsRecording()) {
+                span_->AddEvent("Sent location " + std::to_string(location_.latitude()) + ", " + std::to_string(location_.longitude()));
+            }
+            LOG_DEBUG("[VEHICLE_SERVICE] Sent location for vehicle_id=" << vehicle_id_);
+            if (max_updates_ > 0 && ++sent_ >= max_updates_) {
+                finishLocked(Status::OK);
+                return;
+            }
+            if (dirty_) {
+                dirty_ = false;
+                startWriteLocked();
+            }
+        }
+
+        void OnCancel() override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finishLocked(Status::CANCELLED);
+        }
+
+        void OnDone() override {
+            if (vehicle_) {
+                vehicle_->unsubscribe(this);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+            }
+            LOG_INFO("[VEHICLE_SERVICE] Streaming for vehicle " << vehicle_id_ << " finished.");
+            span_->AddEvent("Finished tracking");
+            span_->End();
+            delete this;
+        }
+
+    private:
+        void startWriteLocked() {
+            auto point = vehicle_->latest();
+            if (!point) {
+                return;
+            }
+            if (service_->track_vehicle_latency_.shouldFail()) {
+                finishLocked(Status(grpc::StatusCode::UNAVAILABLE, "Injected failure"));
+                return;
+            }
+            location_.set_vehicle_id(vehicle_id_);
+            location_.set_latitude(point->latitude);
+            location_.set_longitude(point->longitude);
+            location_.set_timestamp_ms(point->timestamp_ms);
+            writing_ = true;
+
+            auto delay = service_->track_vehicle_latency_.draw();
+            if (delay.count() == 0) {
+                StartWrite(&location_);
+                return;
+            }
+            delaying_ = true;
+            service_->delays_.schedule(delay, [this]() {
+                std::lock_guard<std::mutex> lock(mutex_);
+                delaying_ = false;
+                if (finished_) {
+                    Finish(finish_status_);
+                    return;
+                }
+                StartWrite(&location_);
+            });
+        }
+
+        // A pending delayed write still holds `this`, so it finishes instead
+        void finishLocked(Status status) {
+            if (finished_) {
+                return;
+            }
+            finished_ = true;
+            if (delaying_) {
+                finish_status_ = status;
+                return;
+            }
+            Finish(status);
+        }
+
+        VehicleServiceImpl* service_;
+        VehicleState* vehicle_;
+        int32_t vehicle_id_;
+        int32_t max_updates_;
+        int32_t sent_ = 0;
+        opentelemetry::nostd::shared_ptr<trace_api::Span> span_;
+        Location location_;
+
+        std::mutex mutex_;
+        bool writing_ = false;
+        bool delaying_ = false;
+        bool dirty_ = false;
+        bool finished_ = false;
+        Status finish_status_;
+    };
+
+    // Streams fleet frames from the shared feed: a snapshot on subscribe,
+    // then one delta per tick. Frames are shared with every other watcher
+    // and queue behind the write in flight; a watcher that falls too far
+    // behind drops its queue and is resynced with the next snapshot.
+    class WatchFleetReactor : public grpc::ServerWriteReactor<FleetFrame>, public FleetSubscriber {
+    public:
+        WatchFleetReactor(VehicleServiceImpl* service, const FleetWatchRequest& request)
+            : service_(service), max_frames_(request.max_frames()), span_(service->tracer_->StartSpan("watch_fleet")) {
+            span_->SetAttribute("max_frames", max_frames_);
+            service_->fleet_feed_.subscribe(this);
+        }
+
+        bool onFleetFrame(std::shared_ptr<const FleetFrame> frame) override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (finished_) {
+                return true;
+            }
+            if (frame->snapshot()) {
+                queued_.clear();
+            } else if (queued_.size() >= kMaxQueuedFrames) {
+                queued_.clear();
+                return false;
+            }
+            queued_.push_back(std::move(frame));
+            if (!writing_) {
+                startWriteLocked();
+            }
+            return true;
+        }
+
+        void OnWriteDone(bool ok) override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            writing_ = false;
+            current_.reset();
+            if (!ok) {
+                finishLocked(Status::CANCELLED);
+                return;
+            }
+            if (max_frames_ > 0 && ++sent_ >= max_frames_) {
+                finishLocked(Status::OK);
+                return;
+            }
+            if (!queued_.empty()) {
+                startWriteLocked();
+            }
+        }
+
+        void OnCancel() override {
+            std::lock_guard<std::mutex> lock(mutex_);
+            finishLocked(Status::CANCELLED);
+        }
+
+        void OnDone() override {
+            service_->fleet_feed_.unsubscribe(this);
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+            }
+            span_->SetAttribute("frames_sent", sent_);
+            span_->End();
+            delete this;
+        }
+
+    private:
+        static constexpr size_t kMaxQueuedFrames = 8;
+
+        void startWriteLocked() {
+            current_ = std::move(queued_.front());
+            queued_.pop_front();
+            writing_ = true;
+            StartWrite(current_.get());
+        }
+
+        void finishLocked(Status status) {
+            if (finished_) {
+                return;
+            }
+            finished_ = true;
+            queued_.clear();
+            Finish(status);
+        }
+
+        VehicleServiceImpl* service_;
+        int32_t max_frames_;
+        int32_t sent_ = 0;
+        opentelemetry::nostd::shared_ptr<trace_api::Span> span_;
+
+        std::mutex mutex_;
+        std::deque<std::shared_ptr<const FleetFrame>> queued_;
+        std::shared_ptr<const FleetFrame> current_;
+        bool writing_ = false;
+        bool finished_ = false;
+    };
 
 public:
 	VehicleServiceImpl(std::shared_ptr<grpc::Channel> package_channel)
@@ -124,7 +347,6 @@ public:
 
         tracer_ = trace_api::Provider::GetTracerProvider()->GetTracer("vehicle_service");
         meter_ = metrics_api::Provider::GetMeterProvider()->GetMeter("vehicle_service");
-        logger_ = logs_api::Provider::GetLoggerProvider()->GetLogger("vehicle_service");
 
         send_location_counter = meter_->CreateDoubleCounter("send_location_requests_total");
         track_vehicle_counter = meter_->CreateDoubleCounter("track_vehicle_requests_total");
@@ -139,274 +361,399 @@ public:
 
     }
 
+    // Maps the location history kept in the data directory and archives
+    // every later point to it. Must run before the server starts.
+    void enablePersistence(LocationArchive::Options options) {
+        archive_ = std::make_unique<LocationArchive>(std::move(options));
+        archive_->recover();
+        archive_->start();
+    }
+
+    static int64_t nowMillis() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // The history keeps timestamps non-decreasing, so one fix from a
+    // vehicle whose clock runs far ahead would pin every later point to
+    // its time. Missing timestamps and ones beyond the allowed skew are
+    // replaced with the server's.
+    int64_t serverTimestamp(int64_t timestamp_ms, int64_t now_ms) const {
+        if (timestamp_ms == 0 || timestamp_ms > now_ms + max_clock_skew_.count()) {
+            return now_ms;
+        }
+        return timestamp_ms;
+    }
+
     Status sendLocation(ServerContext* context,
                     ServerReader<Location>* reader,
                     Ack* response) override {
 
         Location loc;
         int32_t vehicle_id = 0;
+        VehicleState* vehicle = nullptr;
+        const VehicleAttributes* vehicle_labels = nullptr;
         int location_count = 0;
 
-        std::map<std::string, std::string> labels = {{"vehicle_id", std::to_string(vehicle_id)}};
-        auto labelkv = opentelemetry::common::KeyValueIterableView<decltype(labels)>{labels};
-        send_location_counter->Add(1.0, labelkv);
+        send_location_counter->Add(1.0);
 
         while (reader->Read(&loc)) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(50 + rand() % 151));
-
-            auto span = tracer_->StartSpan("process_location");
-            span->AddEvent("Starting processing received location");
-            span->SetAttribute("vehicle_id", loc.vehicle_id());
-            span->SetAttribute("latitude", loc.latitude());
-            span->SetAttribute("longitude", loc.longitude());
-            auto ctx = span->GetContext();
+            // Most points are not sampled; their span costs no attributes or events
+            SampledSpan span(*tracer_, "process_location", loc.vehicle_id());
+            span.annotate([&](trace_api::Span& s) {
+                s.AddEvent("Starting processing received location");
+                s.SetAttribute("latitude", loc.latitude());
+                s.SetAttribute("longitude", loc.longitude());
+            });
+            auto ctx = span.context();
+
+            send_location_latency_.sleep();
+            if (send_location_latency_.shouldFail()) {
+                span.fail("Injected failure");
+                return Status(grpc::StatusCode::UNAVAILABLE, "Injected failure");
+            }
 
-            std::shared_ptr<TrackData> track_data;
+            int64_t timestamp_ms = serverTimestamp(loc.timestamp_ms(), nowMillis());
 
-            {
-                std::lock_guard<std::mutex> lock(mutex_);
+            // A stream carries one vehicle, so the table lookup happens once per stream
+            if (!vehicle || loc.vehicle_id() != vehicle_id) {
                 vehicle_id = loc.vehicle_id();
-                vehicle_locations_[vehicle_id].push_back(loc);
-
-                auto it = tracking_data_.find(vehicle_id);
-                if (it != tracking_data_.end()) {
-                    it->second->latest_location = loc;
-                    it->second->updated = true;
-                    track_data = it->second;
-                }
+                vehicle = &vehicles_.get(vehicle_id);
+                vehicle_labels = &vehicle_labels_.of(vehicle_id);
             }
-
-            if (track_data) {
-                std::lock_guard<std::mutex> lock(track_data->track_mutex);
-                track_data->latest_location = loc;
-                track_data->updated = true;
-                track_data->cv.notify_all();
+            LocationPoint point = vehicle->record(LocationPoint{timestamp_ms, loc.latitude(), loc.longitude()});
+            if (archive_) {
+                archive_->append(vehicle_id, point);
             }
 
-            std::cout << "[VEHICLE_SERVICE] Received location for vehicle_id=" << loc.vehicle_id()
-                    << " at (" << loc.latitude() << ", " << loc.longitude() << ")" << std::endl;
-            logger_->EmitLogRecord(opentelemetry::logs::Severity::kDebug, "Received location for vehicle_id=" + std::to_string(loc.vehicle_id()) + " at (" + std::to_string(loc.latitude()) + ", " + std::to_string(loc.longitude()) + ")",
-                                   ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now()));
+            LOG_SPAN_DEBUG(ctx, "[VEHICLE_SERVICE] Received location for vehicle_id=" << loc.vehicle_id()
+                    << " at (" << loc.latitude() << ", " << loc.longitude() << ")");
 
             ++location_count;
 
-            std::map<std::string, std::string> locations_labels = {{"vehicle_id", std::to_string(loc.vehicle_id())}};
-            auto labelkv_locations = opentelemetry::common::KeyValueIterableView<decltype(locations_labels)>{locations_labels};
-            locations_processed_counter->Add(1.0, labelkv_locations);
+            locations_processed_counter->Add(1.0, *vehicle_labels);
 
-            span->AddEvent("Finished processing");
-            span->End();
+            span.annotate([](trace_api::Span& s) { s.AddEvent("Finished processing"); });
         }
 
         response->set_message("Received " + std::to_string(location_count) + " locations for vehicle " + std::to_string(vehicle_id));
-        std::cout << response->message() << std::endl;
-        logger_->EmitLogRecord(opentelemetry::logs::Severity::kInfo, response->message());
-        
+        LOG_INFO(response->message());
+
         return Status::OK;
     }
 
-    Status trackVehicle(ServerContext* context,
-                    const TrackRequest* request,
-                    ServerWriter<Location>* writer) override {
-
-        auto span = tracer_->StartSpan("track_vehicle");
-        span->AddEvent("Starting vehicle tracking");
-        span->SetAttribute("vehicle_id", request->vehicle_id());
-        auto ctx = span->GetContext();
-
-        std::map<std::string, std::string> labels = {{"vehicle_id", std::to_string(request->vehicle_id())}};
-        auto labelkv = opentelemetry::common::KeyValueIterableView<decltype(labels)>{labels};
-        track_vehicle_counter->Add(1.0, labelkv);
-
-        logger_->EmitLogRecord(opentelemetry::logs::Severity::kInfo, "trackVehicle called for vehicle_id=" + std::to_string(request->vehicle_id()),
-                               ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now()));
-
-        std::cout << "[VEHICLE_SERVICE] trackVehicle called for vehicle_id=" << request->vehicle_id() << std::endl;
+    // Batched sendLocation: each batch is recorded, traced and logged as one
+    // unit, so per-fix cost is just decoding and the history append.
+    Status sendLocations(ServerContext* context,
+                         ServerReader<LocationBatch>* reader,
+                         Ack* response) override {
+        LocationBatch batch;
+        std::vector<LocationPoint> points;
+        int32_t vehicle_id = 0;
+        VehicleState* vehicle = nullptr;
+        const VehicleAttributes* vehicle_labels = nullptr;
+        int location_count = 0;
 
-        std::default_random_engine rng(std::random_device{}());
-        std::uniform_real_distribution<double> lat_dist(50.0, 52.0);
-        std::uniform_real_distribution<double> lon_dist(18.0, 20.0);
+        send_location_counter->Add(1.0);
 
-        int32_t vehicle_id = request->vehicle_id();
-        int amount = rand() % 10;
-        for (int i = 0; i < amount; i++) {
+        while (reader->Read(&batch)) {
+            SampledSpan span(*tracer_, "process_location_batch", batch.vehicle_id());
+            auto ctx = span.context();
 
-            Location loc;
-            loc.set_vehicle_id(vehicle_id);
-            loc.set_latitude(lat_dist(rng));
-            loc.set_longitude(lon_dist(rng));
+            send_location_latency_.sleep();
+            if (send_location_latency_.shouldFail()) {
+                span.fail("Injected failure");
+                return Status(grpc::StatusCode::UNAVAILABLE, "Injected failure");
+            }
+            if (!decodeLocations(batch, &points)) {
+                span.fail("Location batch columns differ in length");
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Location batch columns differ in length");
+            }
+            if (points.empty()) {
+                continue;
+            }
+            int64_t now_ms = nowMillis();
+            for (LocationPoint& point : points) {
+                point.timestamp_ms = serverTimestamp(point.timestamp_ms, now_ms);
+            }
+            span.annotate([&](trace_api::Span& s) { s.SetAttribute("batch_size", static_cast<int64_t>(points.size())); });
 
-            std::this_thread::sleep_for(std::chrono::milliseconds(80 + rand() % 171));
+            if (!vehicle || batch.vehicle_id() != vehicle_id) {
+                vehicle_id = batch.vehicle_id();
+                vehicle = &vehicles_.get(vehicle_id);
+                vehicle_labels = &vehicle_labels_.of(vehicle_id);
+            }
+            vehicle->recordBatch(points);
+            if (archive_) {
+                archive_->append(vehicle_id, points);
+            }
+            location_count += points.size();
 
-            writer->Write(loc);
+            const LocationPoint& last = points.back();
+            LOG_SPAN_DEBUG(ctx, "[VEHICLE_SERVICE] Received " << points.size() << " locations for vehicle_id=" << vehicle_id
+                    << ", last at (" << last.latitude << ", " << last.longitude << ")");
 
-            span->AddEvent("Sending location " + std::to_string(loc.latitude()) + ", " + std::to_string(loc.longitude()));
-            logger_->EmitLogRecord(opentelemetry::logs::Severity::kDebug, "Sent location for vehicle_id=" + std::to_string(vehicle_id),
-                                   ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now()));
-            std::cout << "[VEHICLE_SERVICE] Sent location for vehicle_id=" << vehicle_id << std::endl;
+            locations_processed_counter->Add(static_cast<double>(points.size()), *vehicle_labels);
         }
 
-        std::cout << "Streaming for vehicle " << vehicle_id << " finished." << std::endl;
-        logger_->EmitLogRecord(opentelemetry::logs::Severity::kInfo, "Streaming for vehicle " + std::to_string(vehicle_id) + " finished",
-                               ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now()));
+        response->set_message("Received " + std::to_string(location_count) + " locations for vehicle " + std::to_string(vehicle_id));
+        LOG_INFO(response->message());
 
-        span->AddEvent("Finished tracking");
-        span->End();
         return Status::OK;
     }
 
+    grpc::ServerWriteReactor<Location>* trackVehicle(grpc::CallbackServerContext* context,
+                                                     const TrackRequest* request) override {
+        track_vehicle_counter->Add(1.0, vehicle_labels_.find(request->vehicle_id()));
+
+        return new TrackVehicleReactor(this, *request, vehicles_.find(request->vehicle_id()));
+    }
 
-    Status getPackagesDeliveredBy(ServerContext* context,
-                              const DeliveryQuery* request,
-                              DeliveryCount* response) override {
+    grpc::ServerWriteReactor<FleetFrame>* watchFleet(grpc::CallbackServerContext* context,
+                                                     const FleetWatchRequest* request) override {
+        LOG_INFO("[VEHICLE_SERVICE] watchFleet called");
+        return new WatchFleetReactor(this, *request);
+    }
 
+    grpc::ServerUnaryReactor* getPackagesDeliveredBy(grpc::CallbackServerContext* context,
+                                                     const DeliveryQuery* request,
+                                                     DeliveryCount* response) override {
+        auto* reactor = context->DefaultReactor();
         auto span = tracer_->StartSpan("get_packages_delivered_by");
         span->AddEvent("Calling package_service to get packages count");
         span->SetAttribute("vehicle_id", request->vehicle_id());
         auto ctx = span->GetContext();
 
-        std::this_thread::sleep_for(std::chrono::milliseconds(100 + rand() % 201));
-
-        std::cout << "[VEHICLE_SERVICE] getPackagesDeliveredBy called for vehicle_id=" << request->vehicle_id() << std::endl;
-        logger_->EmitLogRecord(opentelemetry::logs::Severity::kInfo, "getPackagesDeliveredBy called for vehicle_id=" + std::to_string(request->vehicle_id()),
-                               ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now()));
-    
-        VehicleQuery query;
-		query.set_vehicle_id(request->vehicle_id());
+        LOG_SPAN_INFO(ctx, "[VEHICLE_SERVICE] getPackagesDeliveredBy called for vehicle_id=" << request->vehicle_id());
 
-		grpc::ClientContext client_context;
-		packages::DeliveredCount pkg_response;
+        int32_t vehicle_id = request->vehicle_id();
+        // The upstream call may be shared with later callers, so it gets a fixed
+        // timeout and each caller checks its own deadline when the result arrives
+        auto caller_deadline = context->deadline();
+
+        auto respond = [this, reactor, response, span, ctx, vehicle_id, caller_deadline](const grpc::Status& status, const int32_t& count) {
+            if (std::chrono::system_clock::now() > caller_deadline) {
+                span->AddEvent("Caller deadline passed before PackageService answered");
+                span->End();
+                reactor->Finish(grpc::Status(grpc::StatusCode::DEADLINE_EXCEEDED, "Deadline exceeded"));
+                return;
+            }
+            if (!status.ok()) {
+                LOG_SPAN_ERROR(ctx, "[VEHICLE_SERVICE] Failed to query PackageService: " << status.error_message());
+                span->AddEvent("Error occured, PackageService not responding");
+                span->End();
+                reactor->Finish(grpc::Status(grpc::StatusCode::UNAVAILABLE, "PackageService not responding"));
+                return;
+            }
+            span->AddEvent("package_service called succesfully");
 
-        auto start_ext_clock = std::chrono::steady_clock::now();
+            get_packages_delivered_counter->Add(1.0, vehicle_labels_.find(vehicle_id));
 
-		grpc::Status status = package_stub_->getDeliveredCountByVehicle(&client_context, query, &pkg_response);
-        
-        auto end_ext_clock = std::chrono::steady_clock::now();
-        std::chrono::duration<double> ext_elapsed_time = end_ext_clock - start_ext_clock;
+            response->set_count(count);
+            span->SetAttribute("package_count", count);
+            LOG_SPAN_INFO(ctx, "[VEHICLE_SERVICE] Queried delivered count from PackageService: " << count);
 
-		if (!status.ok()) {
-            std::cerr << "Failed to query PackageService: " << status.error_message() << std::endl;
-            logger_->EmitLogRecord(opentelemetry::logs::Severity::kError, "Failed to query PackageService: " + status.error_message(),
-                                   ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now()));
-            span->AddEvent("Error occured, PackageService not responding");
+            span->AddEvent("Responded with the delivered count");
             span->End();
-			return grpc::Status(grpc::StatusCode::UNAVAILABLE, "PackageService not responding");
+            reactor->Finish(grpc::Status::OK);
+        };
+
+        auto lookup = [this, reactor, span, vehicle_id, respond]() {
+            if (packages_delivered_latency_.shouldFail()) {
+                span->End();
+                reactor->Finish(grpc::Status(grpc::StatusCode::UNAVAILABLE, "Injected failure"));
+                return;
+            }
+            delivered_counts_.get(vehicle_id, respond, [this](int32_t vehicle_id, DeliveredCountCache::Callback done) {
+                fetchDeliveredCount(vehicle_id, std::chrono::system_clock::now() + package_service_timeout_, std::move(done));
+            });
+        };
+
+        auto delay = packages_delivered_latency_.draw();
+        if (delay.count() == 0) {
+            lookup();
+        } else {
+            delays_.schedule(delay, lookup);
         }
-        span->AddEvent("package_service called succesfully");
+        return reactor;
+    }
 
-        std::map<std::string, std::string> labels = {{"vehicle_id", std::to_string(request->vehicle_id())}};
-        auto labelkv = opentelemetry::common::KeyValueIterableView<decltype(labels)>{labels};
-        get_packages_delivered_counter->Add(1.0, labelkv);
+    // Counts for many vehicles, or the whole fleet, from one PackageService call.
+    grpc::ServerUnaryReactor* getPackagesDeliveredByFleet(grpc::CallbackServerContext* context,
+                                                          const FleetDeliveryQuery* request,
+                                                          FleetDeliveryCounts* response) override {
+        auto* reactor = context->DefaultReactor();
+        auto span = tracer_->StartSpan("get_packages_delivered_by_fleet");
+        span->SetAttribute("all", request->all());
+        span->SetAttribute("vehicle_count", request->vehicle_ids_size());
+
+        struct Call {
+            grpc::ClientContext context;
+            packages::VehicleBatchQuery query;
+            packages::DeliveredCounts response;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        };
+        auto call = std::make_shared<Call>();
+        call->context.set_deadline(std::min(context->deadline(), std::chrono::system_clock::now() + package_service_timeout_));
+        call->query.set_all(request->all());
+        *call->query.mutable_vehicle_ids() = request->vehicle_ids();
+
+        package_stub_->async()->getDeliveredCounts(&call->context, &call->query, &call->response,
+            [this, reactor, response, span, call](grpc::Status status) {
+                std::chrono::duration<double> ext_elapsed_time = std::chrono::steady_clock::now() - call->start;
+                package_service_latency_histogram->Record(ext_elapsed_time.count(), opentelemetry::context::Context{});
+                // A rejected request fails the same way on every retry, so the client must see why
+                if (status.error_code() == grpc::StatusCode::INVALID_ARGUMENT) {
+                    span->AddEvent("PackageService rejected the query");
+                    span->End();
+                    reactor->Finish(status);
+                    return;
+                }
+                if (!status.ok()) {
+                    LOG_ERROR("[VEHICLE_SERVICE] Failed to query PackageService: " << status.error_message());
+                    span->AddEvent("Error occured, PackageService not responding");
+                    span->End();
+                    reactor->Finish(grpc::Status(grpc::StatusCode::UNAVAILABLE, "PackageService not responding"));
+                    return;
+                }
+                response->mutable_counts()->Reserve(call->response.counts_size());
+                for (const auto& count : call->response.counts()) {
+                    auto* entry = response->add_counts();
+                    entry->set_vehicle_id(count.vehicle_id());
+                    entry->set_count(count.count());
+                }
+                span->SetAttribute("result_count", response->counts_size());
+                span->End();
+                reactor->Finish(grpc::Status::OK);
+            });
+        return reactor;
+    }
 
-        package_service_latency_histogram->Record(ext_elapsed_time.count(), opentelemetry::context::Context{});
+    Status getTrajectory(ServerContext* context, const TrajectoryRequest* request, Trajectory* response) override {
+        auto span = tracer_->StartSpan("get_trajectory");
+        span->SetAttribute("vehicle_id", request->vehicle_id());
+        span->SetAttribute("max_points", request->max_points());
 
-        response->set_count(pkg_response.count());
-        span->SetAttribute("package_count", pkg_response.count());
-        std::cout << "Queried delivered count from PackageService: " << pkg_response.count() << std::endl;
-        logger_->EmitLogRecord(opentelemetry::logs::Severity::kError, "Queried delivered count from PackageService: " + std::to_string(pkg_response.count()),
-                               ctx.trace_id(), ctx.span_id(), ctx.trace_flags(),opentelemetry::common::SystemTimestamp(std::chrono::system_clock::now()));
+        if (request->max_points() < 0) {
+            span->End();
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "max_points must not be negative");
+        }
+        int64_t from_ms = request->from_ms();
+        int64_t to_ms = request->to_ms() == 0 ? INT64_MAX : request->to_ms();
+
+        // The archive holds every point, including those from before a restart;
+        // without it only the in-memory rings are available
+        std::vector<LocationPoint> points;
+        VehicleState* vehicle = vehicles_.find(request->vehicle_id());
+        if (archive_) {
+            points = archive_->range(request->vehicle_id(), from_ms, to_ms);
+        } else if (vehicle) {
+            // Copy the range out under the vehicle lock and simplify after releasing it
+            points = vehicle->withHistory([&](const LocationHistory& history) {
+                return history.range(from_ms, to_ms);
+            });
+        }
+        if (!vehicle && points.empty()) {
+            span->End();
+            return Status(grpc::StatusCode::NOT_FOUND, "Vehicle has not reported a location");
+        }
+        response->set_raw_point_count(points.size());
+        if (request->max_points() > 0) {
+            points = simplifyTrajectory(points, request->max_points());
+        }
+        encodeLocations(request->vehicle_id(), points, response->mutable_points());
 
-        span->AddEvent("Responded with the delivered count");
+        span->SetAttribute("raw_point_count", response->raw_point_count());
+        span->SetAttribute("point_count", static_cast<int64_t>(points.size()));
         span->End();
-		return grpc::Status::OK;
-	}
-};
-
-void initTracer()
-{
-    otlp_exporter::OtlpGrpcExporterOptions options;
-    options.endpoint = "simplest-collector:4317";
-    options.use_ssl_credentials = false;
-
-    auto resource_attributes = resource::Resource::Create({
-        {"service.name", "vehicle-service"},
-        {"service.version", "1.0.0"},
-        {"deployment.environment", "dev"}
-    });
-
-    auto exporter = std::unique_ptr<trace_sdk::SpanExporter>(
-        new otlp_exporter::OtlpGrpcExporter(options));
-
-    auto processor = std::unique_ptr<trace_sdk::SpanProcessor>(
-        new trace_sdk::SimpleSpanProcessor(std::move(exporter)));
-
-    auto provider = std::shared_ptr<trace_api::TracerProvider>(
-        new trace_sdk::TracerProvider(std::move(processor), resource_attributes));
-
-    trace_api::Provider::SetTracerProvider(provider);
-}
-
-void AddLatencyView(opentelemetry::sdk::metrics::MeterProvider* provider,
-                    const std::string& name, const std::string& unit) {
-    auto histogram_config = std::make_shared<
-    opentelemetry::sdk::metrics::HistogramAggregationConfig>();
-    histogram_config->boundaries_ = {
-        0,     0.00001, 0.00005, 0.0001, 0.0003, 0.0006, 0.0008, 0.001, 0.002,
-        0.003, 0.004,   0.005,   0.006,  0.008,  0.01,   0.013,  0.016, 0.02,
-        0.025, 0.03,    0.04,    0.05,   0.065,  0.08,   0.1,    0.13,  0.16,
-        0.2,   0.25,    0.3,     0.4,    0.5,    0.65,   0.8,    1,     2,
-        5,     10,      20,      50,     100};
-        provider->AddView(
-            opentelemetry::sdk::metrics::InstrumentSelectorFactory::Create(
-                opentelemetry::sdk::metrics::InstrumentType::kHistogram, name, unit),
-                opentelemetry::sdk::metrics::MeterSelectorFactory::Create(
-                    "grpc-c++", grpc::Version(), ""),
-                          opentelemetry::sdk::metrics::ViewFactory::Create(
-                              name, "", unit,
-                              opentelemetry::sdk::metrics::AggregationType::kHistogram,
-                              std::move(histogram_config)));
-}
-
-void initMetrics()
-{
-    otlp::OtlpGrpcMetricExporterOptions opts;
-    opts.endpoint = "simplest-collector:4317";
-    opts.use_ssl_credentials = false;
-
-    auto exporter = otlp::OtlpGrpcMetricExporterFactory::Create(opts);
+        return Status::OK;
+    }
 
-    metrics_sdk::PeriodicExportingMetricReaderOptions reader_options;
-    reader_options.export_interval_millis = std::chrono::milliseconds(1000);
-    reader_options.export_timeout_millis  = std::chrono::milliseconds(500);
+    Status findVehiclesInArea(ServerContext* context, const AreaQuery* request, VehiclesInArea* response) override {
+        auto span = tracer_->StartSpan("find_vehicles_in_area");
+        auto add = [response](int32_t vehicle_id, GeoPoint position) {
+            Location* loc = response->add_vehicles();
+            loc->set_vehicle_id(vehicle_id);
+            loc->set_latitude(position.latitude);
+            loc->set_longitude(position.longitude);
+        };
+
+        if (request->has_box()) {
+            const auto& box = request->box();
+            if (!validPosition(box.min_latitude(), box.min_longitude()) ||
+                !validPosition(box.max_latitude(), box.max_longitude())) {
+                span->End();
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Box corners must be valid coordinates");
+            }
+            geo_index_.forEachInBox(GeoPoint{box.min_latitude(), box.min_longitude()},
+                                    GeoPoint{box.max_latitude(), box.max_longitude()}, add);
+        } else if (request->has_circle()) {
+            const auto& circle = request->circle();
+            if (!validPosition(circle.latitude(), circle.longitude())) {
+                span->End();
+                return Status(grpc::StatusCode::INVALID_ARGUMENT, "Circle centre must be valid coordinates");
+            }
+            if (!(circle.radius_km() >= 0 && circle.radius_km() <= kMaxRadiusKm)) {
+                span->End();
+                return Status(grpc::StatusCode::INVALID_ARGUMENT,
+                              "radius_km must be between 0 and " + std::to_string(static_cast<int>(kMaxRadiusKm)));
+            }
+            geo_index_.forEachInRadius(GeoPoint{circle.latitude(), circle.longitude()}, circle.radius_km(), add);
+        } else {
+            span->End();
+            return Status(grpc::StatusCode::INVALID_ARGUMENT, "Area must be a box or a circle");
+        }
 
-    auto reader = metrics_sdk::PeriodicExportingMetricReaderFactory::Create(std::move(exporter), reader_options);
-    auto context = metrics_sdk::MeterContextFactory::Create();
-    context->AddMetricReader(std::move(reader));
+        span->SetAttribute("vehicle_count", response->vehicles_size());
+        span->End();
+        return Status::OK;
+    }
 
-    auto u_provider = metrics_sdk::MeterProviderFactory::Create(std::move(context));
-    AddLatencyView(u_provider.get(), "grpc.server.call.duration", "s");
+private:
+    // Half the Earth's circumference: a larger circle covers nothing more
+    static constexpr double kMaxRadiusKm = 20038;
 
-    std::shared_ptr<metrics_api::MeterProvider> provider(std::move(u_provider));
-    metrics_api::Provider::SetMeterProvider(provider);
-}
+    // NaN fails every comparison, so it is rejected too
+    static bool validPosition(double latitude, double longitude) {
+        return latitude >= -90 && latitude <= 90 && longitude >= -180 && longitude <= 180;
+    }
 
-void initLogger()
-{
-    auto resource_attributes = resource::Resource::Create({
-        {"service.name", "vehicle-service"},
-        {"service.version", "1.0.0"},
-        {"deployment.environment", "dev"}
-    });
-    otlp::OtlpGrpcLogRecordExporterOptions opts;
-    opts.endpoint = "simplest-collector:4317";
-    opts.use_ssl_credentials = false;
-    auto exporter = otlp::OtlpGrpcLogRecordExporterFactory::Create(opts);
-    auto processor = logs_sdk::SimpleLogRecordProcessorFactory::Create(std::move(exporter));
-    std::shared_ptr<logs_api::LoggerProvider> provider =
-    logs_sdk::LoggerProviderFactory::Create(std::move(processor), resource_attributes);
-    logs_api::Provider::SetLoggerProvider(provider);
-}
+    // One asynchronous getDeliveredCountByVehicle call; no thread waits on it.
+    void fetchDeliveredCount(int32_t vehicle_id, std::chrono::system_clock::time_point deadline,
+                             DeliveredCountCache::Callback done) {
+        struct Call {
+            grpc::ClientContext context;
+            VehicleQuery query;
+            packages::DeliveredCount response;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        };
+        auto call = std::make_shared<Call>();
+        call->context.set_deadline(deadline);
+        call->query.set_vehicle_id(vehicle_id);
+
+        package_stub_->async()->getDeliveredCountByVehicle(&call->context, &call->query, &call->response,
+            [this, call, done = std::move(done)](grpc::Status status) {
+                std::chrono::duration<double> ext_elapsed_time = std::chrono::steady_clock::now() - call->start;
+                package_service_latency_histogram->Record(ext_elapsed_time.count(), opentelemetry::context::Context{});
+                done(status, call->response.count());
+            });
+    }
+};
 
 int main(int argc, char** argv) {
     std::string server_address("0.0.0.0:50052");
     std::string package_service_address("package-service:50052");
+    initTelemetry(TelemetryOptions::fromEnv("vehicle-service"));
     auto package_channel = grpc::CreateChannel(package_service_address, grpc::InsecureChannelCredentials());
-    initTracer();
-    initMetrics();
-    initLogger();
+    AsyncLog::start(AsyncLog::Options::fromEnv(), logs_api::Provider::GetLoggerProvider()->GetLogger("vehicle_service"));
 
     VehicleServiceImpl service(package_channel);
 
+    LocationArchive::Options persistence = LocationArchive::optionsFromEnv();
+    if (!persistence.dir.empty()) {
+        service.enablePersistence(persistence);
+    }
+
     ServerBuilder builder;
     builder.AddListeningPort(server_address, grpc::InsecureServerCredentials());
     builder.RegisterService(&service);
@@ -415,6 +762,8 @@ int main(int argc, char** argv) {
     std::cout << "VehicleService server listening on " << server_address << std::endl;
 
     server->Wait();
+    AsyncLog::stop();
+    shutdownTelemetry();
 
     return 0;
 }
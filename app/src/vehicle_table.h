@@ -0,0 +1,216 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "location_history.h"
+
+// Latest position of one vehicle behind a sequence lock: a single writer
+// publishes without blocking, and readers retry if they overlap a write.
+class LatestLocation {
+public:
+    // Writers must be serialized by the caller.
+    void store(const LocationPoint& point) {
+        uint64_t seq = seq_.load(std::memory_order_relaxed);
+        seq_.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        timestamp_ms_.store(point.timestamp_ms, std::memory_order_relaxed);
+        latitude_.store(point.latitude, std::memory_order_relaxed);
+        longitude_.store(point.longitude, std::memory_order_relaxed);
+        seq_.store(seq + 2, std::memory_order_release);
+    }
+
+    std::optional<LocationPoint> load() const { return load(nullptr); }
+
+    // Also returns the version the point was read at. Versions only grow,
+    // so a reader that remembers one can tell whether a newer point exists.
+    std::optional<LocationPoint> load(uint64_t* version) const {
+        while (true) {
+            uint64_t before = seq_.load(std::memory_order_acquire);
+            if (before == 0) {
+                return std::nullopt;
+            }
+            if (before & 1) {
+                continue;
+            }
+            LocationPoint point{timestamp_ms_.load(std::memory_order_relaxed),
+                                latitude_.load(std::memory_order_relaxed),
+                                longitude_.load(std::memory_order_relaxed)};
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq_.load(std::memory_order_relaxed) == before) {
+                if (version) {
+                    *version = before;
+                }
+                return point;
+            }
+        }
+    }
+
+    // Odd while a write is in progress.
+    uint64_t version() const { return seq_.load(std::memory_order_acquire); }
+
+private:
+    std::atomic<uint64_t> seq_{0};
+    std::atomic<int64_t> timestamp_ms_{0};
+    std::atomic<double> latitude_{0};
+    std::atomic<double> longitude_{0};
+};
+
+// Told that a vehicle has a new latest point. Called on the ingesting
+// thread with the vehicle's watcher lock held, so it must not block.
+class LocationWatcher {
+public:
+    virtual ~LocationWatcher() = default;
+    virtual void onLocationUpdated() = 0;
+};
+
+// Per-vehicle location state. Appends lock only this vehicle, and the
+// latest point can be read without any lock. Watchers are told about
+// every append and read latest() themselves, so slow ones coalesce.
+class VehicleState {
+public:
+    explicit VehicleState(const LocationHistory::Options& options) : history_(options) {}
+
+    // Returns the point as the history filed it, so other stores of the
+    // same point (the archive, the fleet feed) agree on its timestamp.
+    LocationPoint record(const LocationPoint& point) {
+        LocationPoint filed;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            filed = history_.append(point);
+            latest_.store(filed);
+        }
+        notifyWatchers();
+        return filed;
+    }
+
+    // Appends points in order under one lock and wakes watchers once.
+    // Rewrites each point's timestamp to the one it was filed at.
+    void recordBatch(std::vector<LocationPoint>& points) {
+        if (points.empty()) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (LocationPoint& point : points) {
+                point = history_.append(point);
+            }
+            latest_.store(points.back());
+        }
+        notifyWatchers();
+    }
+
+    void subscribe(LocationWatcher* watcher) {
+        std::lock_guard<std::mutex> lock(watchers_mutex_);
+        watchers_.push_back(watcher);
+        watcher_count_.store(watchers_.size(), std::memory_order_release);
+    }
+
+    // The watcher gets no further calls once this returns.
+    void unsubscribe(LocationWatcher* watcher) {
+        std::lock_guard<std::mutex> lock(watchers_mutex_);
+        watchers_.erase(std::remove(watchers_.begin(), watchers_.end(), watcher), watchers_.end());
+        watcher_count_.store(watchers_.size(), std::memory_order_release);
+    }
+
+    std::optional<LocationPoint> latest() const { return latest_.load(); }
+
+    // The latest point and its version, see LatestLocation::load().
+    std::optional<LocationPoint> latest(uint64_t* version) const { return latest_.load(version); }
+
+    // Cheap check for whether a point newer than `version` was recorded.
+    bool changedSince(uint64_t version) const { return latest_.version() != version; }
+
+    // Runs fn(const LocationHistory&) with appends held off.
+    template <typename Fn>
+    auto withHistory(Fn&& fn) const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return fn(history_);
+    }
+
+private:
+    void notifyWatchers() {
+        if (watcher_count_.load(std::memory_order_acquire) == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(watchers_mutex_);
+        for (LocationWatcher* watcher : watchers_) {
+            watcher->onLocationUpdated();
+        }
+    }
+
+    // Keeps a busy vehicle's lock and seqlock off its neighbours' cache lines
+    alignas(64) mutable std::mutex mutex_;
+    LocationHistory history_;
+    alignas(64) LatestLocation latest_;
+    std::atomic<size_t> watcher_count_{0};
+    std::mutex watchers_mutex_;
+    std::vector<LocationWatcher*> watchers_;
+};
+
+// Vehicles by id in lock-striped shards. Entries are never removed, so
+// a stream can look its vehicle up once and keep the reference.
+class VehicleTable {
+public:
+    static constexpr size_t kShards = 64;
+
+    explicit VehicleTable(LocationHistory::Options options) : options_(options) {}
+
+    VehicleState& get(int32_t vehicle_id) {
+        Shard& shard = shardFor(vehicle_id);
+        {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            auto it = shard.vehicles.find(vehicle_id);
+            if (it != shard.vehicles.end()) {
+                return *it->second;
+            }
+        }
+        std::unique_lock<std::shared_mutex> lock(shard.mutex);
+        auto& state = shard.vehicles[vehicle_id];
+        if (!state) {
+            state = std::make_unique<VehicleState>(options_);
+        }
+        return *state;
+    }
+
+    VehicleState* find(int32_t vehicle_id) {
+        Shard& shard = shardFor(vehicle_id);
+        std::shared_lock<std::shared_mutex> lock(shard.mutex);
+        auto it = shard.vehicles.find(vehicle_id);
+        return it == shard.vehicles.end() ? nullptr : it->second.get();
+    }
+
+    // Calls fn(vehicle_id, const VehicleState&) for every vehicle, under
+    // each shard's shared lock, so only vehicles seen for the first time
+    // wait for it. For background scans; fn must be cheap.
+    template <typename Fn>
+    void forEach(Fn&& fn) const {
+        for (const Shard& shard : shards_) {
+            std::shared_lock<std::shared_mutex> lock(shard.mutex);
+            for (const auto& entry : shard.vehicles) {
+                fn(entry.first, static_cast<const VehicleState&>(*entry.second));
+            }
+        }
+    }
+
+private:
+    struct Shard {
+        mutable std::shared_mutex mutex;
+        std::unordered_map<int32_t, std::unique_ptr<VehicleState>> vehicles;
+    };
+
+    Shard& shardFor(int32_t vehicle_id) {
+        return shards_[static_cast<uint32_t>(vehicle_id) % kShards];
+    }
+
+    LocationHistory::Options options_;
+    std::array<Shard, kShards> shards_;
+};